@@ -1,250 +1,414 @@
 #ifndef BPLUSTREE_HPP
 #define BPLUSTREE_HPP
 
-#include <fstream>
 #include <cstring>
 #include <functional>
+#include "Pager.hpp"
 
 template<typename Key, typename Value, int M = 100>
 class BPlusTree {
 private:
     static constexpr int MAX_KEY = M;
     static constexpr int MIN_KEY = M / 2;
-    
+
+    // Nodes may hold one extra key/child while an overflow is being split.
+    // A freed node keeps its slot in the segment and is chained through `next`.
     struct Node {
         int size;
         bool isLeaf;
         int offset;
         Key keys[MAX_KEY + 1];
+        Value values[MAX_KEY + 1];
         int children[MAX_KEY + 2];
         int next;
-        
+
         Node() : size(0), isLeaf(true), offset(-1), next(-1) {
             memset(children, -1, sizeof(children));
         }
     };
-    
-    std::fstream file;
-    std::string filename;
+
+    static constexpr int HEADER_SIZE = sizeof(int) * 3;
+
+    Segment segment;
     int root;
     int nodeCount;
-    
+    int freeHead;  // First reusable node slot, -1 if none
+
     void writeNode(const Node& node, int offset) {
-        file.seekp(offset);
-        file.write(reinterpret_cast<const char*>(&node), sizeof(Node));
-        file.flush();
+        segment.write(offset, &node, sizeof(Node));
     }
-    
+
     void readNode(Node& node, int offset) {
-        file.seekg(offset);
-        file.read(reinterpret_cast<char*>(&node), sizeof(Node));
+        segment.read(offset, &node, sizeof(Node));
     }
-    
+
     int allocateNode() {
-        int offset = sizeof(int) * 2 + nodeCount * sizeof(Node);
+        if (freeHead != -1) {
+            Node node;
+            readNode(node, freeHead);
+            int offset = freeHead;
+            freeHead = node.next;
+            return offset;
+        }
+        int offset = HEADER_SIZE + nodeCount * sizeof(Node);
         nodeCount++;
         return offset;
     }
-    
+
+    void freeNode(Node& node) {
+        node.size = 0;
+        node.next = freeHead;
+        writeNode(node, node.offset);
+        freeHead = node.offset;
+    }
+
     void writeHeader() {
-        file.seekp(0);
-        file.write(reinterpret_cast<char*>(&root), sizeof(int));
-        file.write(reinterpret_cast<char*>(&nodeCount), sizeof(int));
-        file.flush();
+        int header[3] = {root, nodeCount, freeHead};
+        segment.write(0, header, HEADER_SIZE);
     }
-    
+
     void readHeader() {
-        file.seekg(0);
-        file.read(reinterpret_cast<char*>(&root), sizeof(int));
-        file.read(reinterpret_cast<char*>(&nodeCount), sizeof(int));
+        int header[3];
+        segment.read(0, header, HEADER_SIZE);
+        root = header[0];
+        nodeCount = header[1];
+        freeHead = header[2];
     }
-    
-    void insertNonFull(int offset, const Key& key, const Value& value, int childOffset = -1) {
+
+    // Index of the child subtree that may contain key
+    static int childIndex(const Node& node, const Key& key) {
+        int i = 0;
+        while (i < node.size && !(key < node.keys[i])) {
+            i++;
+        }
+        return i;
+    }
+
+    // Index of the first key not less than key
+    static int lowerBound(const Node& node, const Key& key) {
+        int i = 0;
+        while (i < node.size && node.keys[i] < key) {
+            i++;
+        }
+        return i;
+    }
+
+    // Splits an overflowing node, returning the separator and new right sibling
+    void splitNode(Node& node, Key& upKey, int& upOffset) {
+        Node right;
+        right.isLeaf = node.isLeaf;
+        right.offset = allocateNode();
+
+        int mid = node.size / 2;
+        if (node.isLeaf) {
+            right.size = node.size - mid;
+            for (int i = 0; i < right.size; i++) {
+                right.keys[i] = node.keys[mid + i];
+                right.values[i] = node.values[mid + i];
+            }
+            node.size = mid;
+            right.next = node.next;
+            node.next = right.offset;
+            upKey = right.keys[0];
+        } else {
+            right.size = node.size - mid - 1;
+            for (int i = 0; i < right.size; i++) {
+                right.keys[i] = node.keys[mid + 1 + i];
+                right.children[i] = node.children[mid + 1 + i];
+            }
+            right.children[right.size] = node.children[node.size];
+            upKey = node.keys[mid];
+            node.size = mid;
+        }
+        upOffset = right.offset;
+
+        writeNode(node, node.offset);
+        writeNode(right, right.offset);
+    }
+
+    // Returns true if the node at offset split and a separator must be pushed up
+    bool insertInto(int offset, const Key& key, const Value& value, Key& upKey, int& upOffset) {
         Node node;
         readNode(node, offset);
-        
+
         if (node.isLeaf) {
-            int i = node.size - 1;
-            while (i >= 0 && key < node.keys[i]) {
-                node.keys[i + 1] = node.keys[i];
-                i--;
+            int pos = lowerBound(node, key);
+            if (pos < node.size && node.keys[pos] == key) {
+                node.values[pos] = value;
+                writeNode(node, offset);
+                return false;
             }
-            node.keys[i + 1] = key;
+            for (int i = node.size; i > pos; i--) {
+                node.keys[i] = node.keys[i - 1];
+                node.values[i] = node.values[i - 1];
+            }
+            node.keys[pos] = key;
+            node.values[pos] = value;
             node.size++;
-            writeNode(node, offset);
         } else {
-            int i = node.size - 1;
-            while (i >= 0 && key < node.keys[i]) {
-                i--;
+            int idx = childIndex(node, key);
+            Key childKey;
+            int childOffset;
+            if (!insertInto(node.children[idx], key, value, childKey, childOffset)) {
+                return false;
             }
-            i++;
-            
-            Node child;
-            readNode(child, node.children[i]);
-            
-            if (child.size == MAX_KEY) {
-                splitChild(offset, i);
-                readNode(node, offset);
-                if (key > node.keys[i]) {
-                    i++;
+            for (int i = node.size; i > idx; i--) {
+                node.keys[i] = node.keys[i - 1];
+                node.children[i + 1] = node.children[i];
+            }
+            node.keys[idx] = childKey;
+            node.children[idx + 1] = childOffset;
+            node.size++;
+        }
+
+        if (node.size <= MAX_KEY) {
+            writeNode(node, offset);
+            return false;
+        }
+        splitNode(node, upKey, upOffset);
+        return true;
+    }
+
+    // Fixes an underfull child by borrowing from or merging with a sibling
+    void rebalance(Node& parent, int idx, Node& child) {
+        if (idx > 0) {
+            Node left;
+            readNode(left, parent.children[idx - 1]);
+            if (left.size > MIN_KEY) {
+                for (int i = child.size; i > 0; i--) {
+                    child.keys[i] = child.keys[i - 1];
+                    child.values[i] = child.values[i - 1];
                 }
+                if (child.isLeaf) {
+                    child.keys[0] = left.keys[left.size - 1];
+                    child.values[0] = left.values[left.size - 1];
+                    parent.keys[idx - 1] = child.keys[0];
+                } else {
+                    for (int i = child.size + 1; i > 0; i--) {
+                        child.children[i] = child.children[i - 1];
+                    }
+                    child.keys[0] = parent.keys[idx - 1];
+                    child.children[0] = left.children[left.size];
+                    parent.keys[idx - 1] = left.keys[left.size - 1];
+                }
+                child.size++;
+                left.size--;
+                writeNode(left, left.offset);
+                writeNode(child, child.offset);
+                writeNode(parent, parent.offset);
+                return;
             }
-            insertNonFull(node.children[i], key, value);
-        }
-    }
-    
-    void splitChild(int parentOffset, int childIndex) {
-        Node parent, child, newChild;
-        readNode(parent, parentOffset);
-        readNode(child, parent.children[childIndex]);
-        
-        newChild.isLeaf = child.isLeaf;
-        newChild.size = MIN_KEY;
-        
-        int mid = MIN_KEY;
-        for (int i = 0; i < MIN_KEY; i++) {
-            newChild.keys[i] = child.keys[mid + i];
-            if (!child.isLeaf) {
-                newChild.children[i] = child.children[mid + i];
+        }
+
+        if (idx < parent.size) {
+            Node right;
+            readNode(right, parent.children[idx + 1]);
+            if (right.size > MIN_KEY) {
+                if (child.isLeaf) {
+                    child.keys[child.size] = right.keys[0];
+                    child.values[child.size] = right.values[0];
+                } else {
+                    child.keys[child.size] = parent.keys[idx];
+                    child.children[child.size + 1] = right.children[0];
+                    parent.keys[idx] = right.keys[0];
+                    for (int i = 0; i < right.size; i++) {
+                        right.children[i] = right.children[i + 1];
+                    }
+                }
+                child.size++;
+                for (int i = 0; i < right.size - 1; i++) {
+                    right.keys[i] = right.keys[i + 1];
+                    right.values[i] = right.values[i + 1];
+                }
+                right.size--;
+                if (child.isLeaf) {
+                    parent.keys[idx] = right.keys[0];
+                }
+                writeNode(right, right.offset);
+                writeNode(child, child.offset);
+                writeNode(parent, parent.offset);
+                return;
             }
         }
-        if (!child.isLeaf) {
-            newChild.children[MIN_KEY] = child.children[MAX_KEY];
-        }
-        
-        child.size = MIN_KEY;
-        
-        if (child.isLeaf) {
-            newChild.next = child.next;
-            int newOffset = allocateNode();
-            child.next = newOffset;
-            newChild.offset = newOffset;
+
+        // Neither sibling can spare a key: merge with one of them
+        if (idx > 0) {
+            Node left;
+            readNode(left, parent.children[idx - 1]);
+            mergeNodes(parent, idx - 1, left, child);
+        } else {
+            Node right;
+            readNode(right, parent.children[idx + 1]);
+            mergeNodes(parent, idx, child, right);
+        }
+    }
+
+    // Appends right into left and drops separator sep from the parent
+    void mergeNodes(Node& parent, int sep, Node& left, Node& right) {
+        if (left.isLeaf) {
+            for (int i = 0; i < right.size; i++) {
+                left.keys[left.size + i] = right.keys[i];
+                left.values[left.size + i] = right.values[i];
+            }
+            left.size += right.size;
+            left.next = right.next;
         } else {
-            int newOffset = allocateNode();
-            newChild.offset = newOffset;
-        }
-        
-        for (int i = parent.size; i > childIndex; i--) {
-            parent.keys[i] = parent.keys[i - 1];
-            parent.children[i + 1] = parent.children[i];
-        }
-        
-        parent.keys[childIndex] = child.isLeaf ? newChild.keys[0] : child.keys[MIN_KEY];
-        parent.children[childIndex + 1] = newChild.offset;
-        parent.size++;
-        
-        writeNode(child, parent.children[childIndex]);
-        writeNode(newChild, newChild.offset);
-        writeNode(parent, parentOffset);
-    }
-    
+            left.keys[left.size] = parent.keys[sep];
+            for (int i = 0; i < right.size; i++) {
+                left.keys[left.size + 1 + i] = right.keys[i];
+                left.children[left.size + 1 + i] = right.children[i];
+            }
+            left.children[left.size + 1 + right.size] = right.children[right.size];
+            left.size += right.size + 1;
+        }
+
+        for (int i = sep; i < parent.size - 1; i++) {
+            parent.keys[i] = parent.keys[i + 1];
+            parent.children[i + 1] = parent.children[i + 2];
+        }
+        parent.size--;
+
+        writeNode(left, left.offset);
+        freeNode(right);
+        writeNode(parent, parent.offset);
+    }
+
+    // Returns true if key was found and removed from the subtree at node
+    bool eraseFrom(Node& node, const Key& key) {
+        if (node.isLeaf) {
+            int pos = lowerBound(node, key);
+            if (pos == node.size || !(node.keys[pos] == key)) {
+                return false;
+            }
+            for (int i = pos; i < node.size - 1; i++) {
+                node.keys[i] = node.keys[i + 1];
+                node.values[i] = node.values[i + 1];
+            }
+            node.size--;
+            writeNode(node, node.offset);
+            return true;
+        }
+
+        int idx = childIndex(node, key);
+        Node child;
+        readNode(child, node.children[idx]);
+        if (!eraseFrom(child, key)) {
+            return false;
+        }
+        if (child.size < MIN_KEY) {
+            rebalance(node, idx, child);
+        }
+        return true;
+    }
+
 public:
-    BPlusTree(const std::string& fname) : filename(fname), root(-1), nodeCount(0) {
-        file.open(filename, std::ios::in | std::ios::out | std::ios::binary);
-        
-        if (!file.is_open()) {
-            file.clear();
-            file.open(filename, std::ios::out | std::ios::binary);
-            file.close();
-            file.open(filename, std::ios::in | std::ios::out | std::ios::binary);
+    BPlusTree(Pager& pager, const char* name) : segment(pager, name), root(-1), nodeCount(0), freeHead(-1) {
+        if (segment.size() == 0) {
             writeHeader();
         } else {
             readHeader();
         }
     }
-    
+
     ~BPlusTree() {
-        if (file.is_open()) {
-            writeHeader();
-            file.close();
-        }
+        writeHeader();
     }
-    
+
+    // Inserts key, or overwrites its value if already present
     void insert(const Key& key, const Value& value) {
         if (root == -1) {
             Node node;
             node.isLeaf = true;
             node.size = 1;
             node.keys[0] = key;
+            node.values[0] = value;
             root = allocateNode();
             node.offset = root;
             writeNode(node, root);
             writeHeader();
             return;
         }
-        
-        Node rootNode;
-        readNode(rootNode, root);
-        
-        if (rootNode.size == MAX_KEY) {
+
+        Key upKey;
+        int upOffset;
+        if (insertInto(root, key, value, upKey, upOffset)) {
             Node newRoot;
             newRoot.isLeaf = false;
-            newRoot.size = 0;
-            int newRootOffset = allocateNode();
-            newRoot.offset = newRootOffset;
+            newRoot.size = 1;
+            newRoot.offset = allocateNode();
+            newRoot.keys[0] = upKey;
             newRoot.children[0] = root;
-            writeNode(newRoot, newRootOffset);
-            
-            splitChild(newRootOffset, 0);
-            root = newRootOffset;
-            writeHeader();
-            insertNonFull(root, key, value);
-        } else {
-            insertNonFull(root, key, value);
+            newRoot.children[1] = upOffset;
+            writeNode(newRoot, newRoot.offset);
+            root = newRoot.offset;
+        }
+        writeHeader();
+    }
+
+    // Removes key; freed nodes go onto the free list for reuse
+    bool erase(const Key& key) {
+        if (root == -1) return false;
+
+        Node rootNode;
+        readNode(rootNode, root);
+        if (!eraseFrom(rootNode, key)) {
+            return false;
         }
+
+        if (rootNode.isLeaf && rootNode.size == 0) {
+            freeNode(rootNode);
+            root = -1;
+        } else if (!rootNode.isLeaf && rootNode.size == 0) {
+            int newRoot = rootNode.children[0];
+            freeNode(rootNode);
+            root = newRoot;
+        }
+        writeHeader();
+        return true;
     }
-    
+
     bool find(const Key& key, Value& value) {
         if (root == -1) return false;
-        
-        int currentOffset = root;
-        while (true) {
-            Node node;
-            readNode(node, currentOffset);
-            
-            int i = 0;
-            while (i < node.size && key >= node.keys[i]) {
-                if (node.isLeaf && key == node.keys[i]) {
-                    return true;
-                }
-                i++;
-            }
-            
-            if (node.isLeaf) {
-                return false;
-            }
-            currentOffset = node.children[i];
+
+        Node node;
+        readNode(node, root);
+        while (!node.isLeaf) {
+            readNode(node, node.children[childIndex(node, key)]);
         }
+
+        int pos = lowerBound(node, key);
+        if (pos < node.size && node.keys[pos] == key) {
+            value = node.values[pos];
+            return true;
+        }
+        return false;
     }
-    
+
     void clear() {
-        file.close();
-        std::remove(filename.c_str());
-        file.open(filename, std::ios::out | std::ios::binary);
-        file.close();
-        file.open(filename, std::ios::in | std::ios::out | std::ios::binary);
+        segment.clear();
         root = -1;
         nodeCount = 0;
+        freeHead = -1;
         writeHeader();
     }
-    
+
     template<typename Func>
     void traverse(Func func) {
         if (root == -1) return;
-        
+
         int currentOffset = root;
         Node node;
         readNode(node, currentOffset);
-        
+
         while (!node.isLeaf) {
             currentOffset = node.children[0];
             readNode(node, currentOffset);
         }
-        
+
         while (currentOffset != -1) {
             readNode(node, currentOffset);
             for (int i = 0; i < node.size; i++) {
-                func(node.keys[i]);
+                func(node.keys[i], node.values[i]);
             }
             currentOffset = node.next;
         }
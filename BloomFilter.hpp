@@ -0,0 +1,75 @@
+#ifndef BLOOMFILTER_HPP
+#define BLOOMFILTER_HPP
+
+#include <cstring>
+#include <cstdint>
+#include "Pager.hpp"
+
+// Bloom filter over FixedString keys, persisted in a pager segment.
+// The bit array is held in memory; each add() writes back only the bytes
+// it changed. Keys cannot be removed, so deletions leave false positives
+// behind until the filter is cleared.
+template<int BITS = (1 << 18), int HASHES = 7>
+class BloomFilter {
+private:
+    static constexpr int BYTES = BITS / 8;
+
+    Segment segment;
+    unsigned char* bits;
+
+    // Double hashing: probe i is h1 + i * h2
+    template<typename Key>
+    static void probes(const Key& key, uint32_t& h1, uint32_t& h2) {
+        h1 = key.hash();
+        h2 = h1 * 0x9E3779B1u;
+        h2 = (h2 >> 15 | h2 << 17) | 1;
+    }
+
+public:
+    BloomFilter(Pager& pager, const char* name) : segment(pager, name) {
+        bits = new unsigned char[BYTES];
+        if (segment.size() >= BYTES) {
+            segment.read(0, bits, BYTES);
+        } else {
+            memset(bits, 0, BYTES);
+            segment.write(0, bits, BYTES);
+        }
+    }
+
+    ~BloomFilter() { delete[] bits; }
+
+    template<typename Key>
+    void add(const Key& key) {
+        uint32_t h1, h2;
+        probes(key, h1, h2);
+        for (int i = 0; i < HASHES; i++) {
+            uint32_t bit = (h1 + i * h2) % BITS;
+            unsigned char mask = (unsigned char)(1 << (bit & 7));
+            if (!(bits[bit >> 3] & mask)) {
+                bits[bit >> 3] |= mask;
+                segment.write(bit >> 3, &bits[bit >> 3], 1);
+            }
+        }
+    }
+
+    // False means the key was never added; true means it may have been
+    template<typename Key>
+    bool mightContain(const Key& key) const {
+        uint32_t h1, h2;
+        probes(key, h1, h2);
+        for (int i = 0; i < HASHES; i++) {
+            uint32_t bit = (h1 + i * h2) % BITS;
+            if (!(bits[bit >> 3] & (1 << (bit & 7)))) return false;
+        }
+        return true;
+    }
+
+    long long memoryUsage() const { return BYTES; }
+
+    void clear() {
+        memset(bits, 0, BYTES);
+        segment.write(0, bits, BYTES);
+    }
+};
+
+#endif
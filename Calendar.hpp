@@ -0,0 +1,122 @@
+#ifndef CALENDAR_HPP
+#define CALENDAR_HPP
+
+// Integer time representation.
+//
+// A TimePoint is the number of minutes since 00:00 on day 0, the first day
+// of the season. Day numbers and month/day conversions come from constexpr
+// tables, so all time arithmetic in the query and purchase paths is plain
+// integer math. The tables run from the start of the season through the
+// last day a train on sale can reach, wrapping into the following years.
+
+typedef int TimePoint;
+
+const int MINUTES_PER_DAY = 24 * 60;
+const int SEASON_YEAR = 2021;
+const int SEASON_FIRST_MONTH = 6;
+const int SEASON_LAST_SALE_DAY = 91;  // 08-31
+
+// Longest journey the input limits allow: 99 legs of 10000 minutes, 98
+// stopovers of 10000 minutes, leaving at 23:59
+const int MAX_JOURNEY_DAYS = (99 * 10000 + 98 * 10000 + MINUTES_PER_DAY - 1) / MINUTES_PER_DAY + 1;
+
+struct CalendarTables {
+    static constexpr int MAX_DAYS = SEASON_LAST_SALE_DAY + MAX_JOURNEY_DAYS + 1;
+
+    int monthStart[14];  // Day number of the 1st of each month of the season year, 0 before it
+    unsigned char dayMonth[MAX_DAYS];
+    unsigned char dayOfMonth[MAX_DAYS];
+    int dayCount;
+
+    static constexpr int monthLength(int year, int month) {
+        return month == 2 ? (year % 4 == 0 && (year % 100 != 0 || year % 400 == 0) ? 29 : 28)
+                          : month == 4 || month == 6 || month == 9 || month == 11 ? 30 : 31;
+    }
+
+    constexpr CalendarTables() : monthStart(), dayMonth(), dayOfMonth(), dayCount(0) {
+        int year = SEASON_YEAR;
+        int month = SEASON_FIRST_MONTH;
+        int day = 1;
+        for (; dayCount < MAX_DAYS; dayCount++) {
+            if (year == SEASON_YEAR && day == 1) monthStart[month] = dayCount;
+            dayMonth[dayCount] = (unsigned char)month;
+            dayOfMonth[dayCount] = (unsigned char)day;
+            if (++day > monthLength(year, month)) {
+                day = 1;
+                if (++month > 12) {
+                    if (year == SEASON_YEAR) monthStart[13] = dayCount + 1;
+                    month = 1;
+                    year++;
+                }
+            }
+        }
+    }
+};
+
+constexpr CalendarTables CALENDAR = CalendarTables();
+
+// Day number of an "mm-dd" date
+inline int parseDate(const char* mmdd) {
+    int month = (mmdd[0] - '0') * 10 + (mmdd[1] - '0');
+    int day = (mmdd[3] - '0') * 10 + (mmdd[4] - '0');
+    return CALENDAR.monthStart[month] + day - 1;
+}
+
+// Minutes after midnight of an "hh:mm" clock time
+inline int parseClock(const char* hhmm) {
+    return ((hhmm[0] - '0') * 10 + (hhmm[1] - '0')) * 60 + (hhmm[3] - '0') * 10 + (hhmm[4] - '0');
+}
+
+inline char* formatTwoDigits(char* out, int value) {
+    out[0] = (char)('0' + value / 10);
+    out[1] = (char)('0' + value % 10);
+    return out + 2;
+}
+
+// Writes the "mm-dd" of a day number; "xx-xx" outside the tables
+inline char* formatDate(char* out, int day) {
+    if (day < 0 || day >= CALENDAR.dayCount) {
+        const char text[] = "xx-xx";
+        for (int i = 0; i < 5; i++) out[i] = text[i];
+        return out + 5;
+    }
+    out = formatTwoDigits(out, CALENDAR.dayMonth[day]);
+    *out++ = '-';
+    return formatTwoDigits(out, CALENDAR.dayOfMonth[day]);
+}
+
+// Writes "mm-dd hh:mm" and returns the end of the written text
+inline char* formatTime(char* out, TimePoint time) {
+    int minutes = time % MINUTES_PER_DAY;
+    out = formatDate(out, time / MINUTES_PER_DAY);
+    *out++ = ' ';
+    out = formatTwoDigits(out, minutes / 60);
+    *out++ = ':';
+    return formatTwoDigits(out, minutes % 60);
+}
+
+// Writes the placeholder used where a time does not apply
+inline char* formatNoTime(char* out) {
+    const char text[] = "xx-xx xx:xx";
+    for (int i = 0; i < 11; i++) out[i] = text[i];
+    return out + 11;
+}
+
+// Writes a non-negative integer and returns the end of the written text
+inline char* formatInt(char* out, int value) {
+    char digits[12];
+    int n = 0;
+    do {
+        digits[n++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    while (n > 0) *out++ = digits[--n];
+    return out;
+}
+
+inline char* formatText(char* out, const char* text) {
+    while (*text) *out++ = *text++;
+    return out;
+}
+
+#endif
@@ -0,0 +1,170 @@
+#ifndef COMMANDREADER_HPP
+#define COMMANDREADER_HPP
+
+#include <cstring>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unistd.h>
+
+const int MAX_COMMAND_PARAMS = 20;
+
+// One input line split into its name and "-k value" parameters
+struct Command {
+    std::string name;
+    char keys[MAX_COMMAND_PARAMS];
+    std::string values[MAX_COMMAND_PARAMS];
+    int count;
+
+    Command() : count(0) {}
+};
+
+inline bool isCommandSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Splits a line on whitespace. A two-character token starting with '-'
+// takes the next token as its value; other tokens are skipped.
+inline void tokenizeCommand(const char* line, int len, Command& command) {
+    command.name.clear();
+    command.count = 0;
+    bool first = true;
+    bool pending = false;
+    char pendingKey = 0;
+    for (int i = 0; i < len;) {
+        while (i < len && isCommandSpace(line[i])) i++;
+        if (i == len) break;
+        int start = i;
+        while (i < len && !isCommandSpace(line[i])) i++;
+        const char* token = line + start;
+        int tokenLen = i - start;
+
+        if (first) {
+            command.name.assign(token, tokenLen);
+            first = false;
+        }
+        if (pending) {
+            if (command.count < MAX_COMMAND_PARAMS) {
+                command.keys[command.count] = pendingKey;
+                command.values[command.count].assign(token, tokenLen);
+                command.count++;
+            }
+            pending = false;
+        } else if (token[0] == '-' && tokenLen == 2) {
+            pending = true;
+            pendingKey = token[1];
+        }
+    }
+}
+
+// Reads commands on a background thread and hands them over in order.
+//
+// The reader pulls stdin in large blocks, finds line ends with memchr
+// (vectorised in libc) and tokenizes each line straight into a slot of a
+// single-producer/single-consumer ring. Slots and their strings are
+// reused, so steady-state reading does not allocate. The consumer executes
+// commands one at a time, so semantics stay strictly sequential.
+class CommandReader {
+private:
+    static const int RING_SLOTS = 256;  // Power of two
+    static const int BLOCK_SIZE = 1 << 16;
+
+    Command ring[RING_SLOTS];
+    std::atomic<unsigned int> head;  // Next slot to consume
+    std::atomic<unsigned int> tail;  // Next slot to fill
+    std::atomic<bool> finished;
+    int fd;
+    std::thread reader;
+
+    // Either side sleeps here once spinning has not paid off
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::atomic<int> sleepers;
+
+    template<typename Ready>
+    void waitUntil(Ready ready) {
+        for (int spins = 0; spins < 256; spins++) {
+            if (ready()) return;
+            if (spins >= 64) std::this_thread::yield();
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        sleepers++;
+        changed.wait(lock, ready);
+        sleepers--;
+    }
+
+    void wakeOther() {
+        if (sleepers.load() == 0) return;
+        std::lock_guard<std::mutex> lock(mutex);
+        changed.notify_all();
+    }
+
+    void publish(const char* line, int len) {
+        unsigned int t = tail.load(std::memory_order_relaxed);
+        waitUntil([&] { return t - head.load() != (unsigned int)RING_SLOTS; });
+        tokenizeCommand(line, len, ring[t % RING_SLOTS]);
+        if (ring[t % RING_SLOTS].name.empty()) return;
+        tail.store(t + 1);
+        wakeOther();
+    }
+
+    void readLoop() {
+        char* block = new char[BLOCK_SIZE];
+        std::string partial;  // Line split across blocks
+        while (true) {
+            ssize_t n = ::read(fd, block, BLOCK_SIZE);
+            if (n <= 0) break;
+            const char* p = block;
+            const char* end = block + n;
+            while (p < end) {
+                const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+                if (!nl) {
+                    partial.append(p, end - p);
+                    break;
+                }
+                if (partial.empty()) {
+                    publish(p, nl - p);
+                } else {
+                    partial.append(p, nl - p);
+                    publish(partial.data(), partial.size());
+                    partial.clear();
+                }
+                p = nl + 1;
+            }
+        }
+        if (!partial.empty()) publish(partial.data(), partial.size());
+        delete[] block;
+        finished.store(true);
+        wakeOther();
+    }
+
+public:
+    explicit CommandReader(int inputFd = 0) : head(0), tail(0), finished(false), fd(inputFd), sleepers(0) {
+        reader = std::thread(&CommandReader::readLoop, this);
+    }
+
+    ~CommandReader() {
+        reader.join();
+    }
+
+    // Ring and read block; strings in the slots grow to the longest line seen
+    static long long memoryUsage() { return sizeof(CommandReader) + BLOCK_SIZE; }
+
+    // Next command, or nullptr at end of input. The command stays valid
+    // until release() is called.
+    Command* next() {
+        unsigned int h = head.load(std::memory_order_relaxed);
+        waitUntil([&] { return h != tail.load() || finished.load(); });
+        if (h == tail.load()) return nullptr;
+        return &ring[h % RING_SLOTS];
+    }
+
+    void release() {
+        head.store(head.load(std::memory_order_relaxed) + 1);
+        wakeOther();
+    }
+};
+
+#endif
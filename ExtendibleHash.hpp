@@ -0,0 +1,227 @@
+#ifndef EXTENDIBLEHASH_HPP
+#define EXTENDIBLEHASH_HPP
+
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "Pager.hpp"
+
+// Extendible hash index from FixedString keys to int values.
+//
+// Buckets are single pages in the "<name>_buckets" segment, addressed by
+// bucket number. The directory maps the low globalDepth bits of a key's
+// hash to a bucket; it is a few KiB even for tens of thousands of keys, so
+// it is kept in memory and mirrored to "<name>_dir" like BloomFilter's
+// bits. A lookup therefore touches one bucket page: it reads the bucket's
+// array of full hashes, then only the entry whose hash matches. A full
+// bucket splits on its next hash bit, doubling the directory first when
+// its local depth has caught up with the global depth. Erased entries free
+// their slot but buckets never merge.
+template<typename Key>
+class ExtendibleHash : public MemoryConsumer {
+private:
+    static const int MAX_DEPTH = 24;
+
+    struct Entry {
+        Key key;
+        int value;
+    };
+
+    static constexpr int CAPACITY = (int)((PAGE_SIZE - 2 * sizeof(int)) / (sizeof(uint32_t) + sizeof(Entry)));
+
+    // Start of a bucket page, which is all a lookup reads before its entry.
+    // Entries follow it in the page.
+    struct Probe {
+        int localDepth;
+        int count;
+        uint32_t hashes[CAPACITY];  // mix() of each entry's key
+    };
+
+    // Whole bucket, only built when splitting
+    struct Bucket {
+        Probe probe;
+        Entry entries[CAPACITY];
+    };
+
+    static_assert(sizeof(Probe) + CAPACITY * sizeof(Entry) <= PAGE_SIZE, "a bucket must fit in one page");
+
+    Segment dirSegment;
+    Segment bucketSegment;
+    int globalDepth;
+    int bucketCount;
+    int* directory;  // 1 << globalDepth bucket numbers
+
+    // Spreads FixedString's polynomial hash over the low bits
+    static uint32_t mix(uint32_t h) {
+        h ^= h >> 16;
+        h *= 0x85EBCA6Bu;
+        h ^= h >> 13;
+        h *= 0xC2B2AE35u;
+        h ^= h >> 16;
+        return h;
+    }
+
+    static long long bucketOffset(int bucket) { return (long long)bucket * PAGE_SIZE; }
+
+    static long long entryOffset(int bucket, int slot) {
+        return bucketOffset(bucket) + sizeof(Probe) + (long long)slot * sizeof(Entry);
+    }
+
+    int bucketOf(uint32_t h) const { return directory[h & ((1u << globalDepth) - 1)]; }
+
+    void readProbe(int bucket, Probe& probe) {
+        bucketSegment.read(bucketOffset(bucket), &probe, sizeof(Probe));
+    }
+
+    void writeBucket(int bucket, const Bucket& b) {
+        bucketSegment.write(bucketOffset(bucket), &b.probe, sizeof(Probe));
+        bucketSegment.write(entryOffset(bucket, 0), b.entries, b.probe.count * sizeof(Entry));
+    }
+
+    // Slot of key in bucket, or -1
+    int locate(int bucket, uint32_t h, const Key& key, Probe& probe, Entry& entry) {
+        readProbe(bucket, probe);
+        for (int i = 0; i < probe.count; i++) {
+            if (probe.hashes[i] != h) continue;
+            bucketSegment.read(entryOffset(bucket, i), &entry, sizeof(Entry));
+            if (entry.key == key) return i;
+        }
+        return -1;
+    }
+
+    // Writes slot i of bucket together with the count that covers it
+    void writeSlot(int bucket, int i, uint32_t h, const Entry& entry, int count) {
+        bucketSegment.write(entryOffset(bucket, i), &entry, sizeof(Entry));
+        bucketSegment.write(bucketOffset(bucket) + offsetof(Probe, hashes) + i * sizeof(uint32_t), &h, sizeof(h));
+        bucketSegment.write(bucketOffset(bucket) + offsetof(Probe, count), &count, sizeof(int));
+    }
+
+    void saveDirectory() {
+        int header[2] = {globalDepth, bucketCount};
+        dirSegment.write(0, header, sizeof(header));
+        dirSegment.write(sizeof(header), directory, (1 << globalDepth) * sizeof(int));
+    }
+
+    void reset() {
+        delete[] directory;
+        globalDepth = 0;
+        bucketCount = 1;
+        directory = new int[1];
+        directory[0] = 0;
+        Probe empty;
+        empty.localDepth = 0;
+        empty.count = 0;
+        bucketSegment.write(0, &empty, sizeof(Probe));
+        saveDirectory();
+    }
+
+    // Splits a full bucket on its next hash bit; false once keys cannot be told apart
+    bool split(int bucket, const Probe& probe) {
+        if (probe.localDepth == MAX_DEPTH) return false;
+        Bucket* full = new Bucket();
+        full->probe = probe;
+        bucketSegment.read(entryOffset(bucket, 0), full->entries, probe.count * sizeof(Entry));
+        if (probe.localDepth == globalDepth) {
+            int size = 1 << globalDepth;
+            int* grown = new int[size * 2];
+            memcpy(grown, directory, size * sizeof(int));
+            memcpy(grown + size, directory, size * sizeof(int));
+            delete[] directory;
+            directory = grown;
+            globalDepth++;
+        }
+
+        int bit = 1 << probe.localDepth;
+        int sibling = bucketCount++;
+        Bucket* halves = new Bucket[2];  // Bit clear, bit set
+        for (int half = 0; half < 2; half++) {
+            halves[half].probe.localDepth = probe.localDepth + 1;
+            halves[half].probe.count = 0;
+        }
+        for (int i = 0; i < probe.count; i++) {
+            Bucket& target = halves[(probe.hashes[i] & bit) ? 1 : 0];
+            target.probe.hashes[target.probe.count] = probe.hashes[i];
+            target.entries[target.probe.count++] = full->entries[i];
+        }
+        writeBucket(bucket, halves[0]);
+        writeBucket(sibling, halves[1]);
+        delete full;
+        delete[] halves;
+        for (int i = 0; i < (1 << globalDepth); i++) {
+            if (directory[i] == bucket && (i & bit)) directory[i] = sibling;
+        }
+        saveDirectory();
+        return true;
+    }
+
+public:
+    ExtendibleHash(Pager& pager, const std::string& name)
+        : dirSegment(pager, (name + "_dir").c_str()), bucketSegment(pager, (name + "_buckets").c_str()),
+          globalDepth(0), bucketCount(0), directory(nullptr) {
+        int header[2];
+        if (dirSegment.size() < (long long)sizeof(header)) {
+            reset();
+            return;
+        }
+        dirSegment.read(0, header, sizeof(header));
+        globalDepth = header[0];
+        bucketCount = header[1];
+        directory = new int[1 << globalDepth];
+        dirSegment.read(sizeof(header), directory, (1 << globalDepth) * sizeof(int));
+    }
+
+    ~ExtendibleHash() { delete[] directory; }
+
+    // Safe from several threads as long as nothing is inserted or erased
+    bool find(const Key& key, int& value) {
+        uint32_t h = mix(key.hash());
+        Probe probe;
+        Entry entry;
+        if (locate(bucketOf(h), h, key, probe, entry) == -1) return false;
+        value = entry.value;
+        return true;
+    }
+
+    // key must not be present; false if its bucket can no longer split
+    bool insert(const Key& key, int value) {
+        uint32_t h = mix(key.hash());
+        Entry entry;
+        entry.key = key;
+        entry.value = value;
+        while (true) {
+            int bucket = bucketOf(h);
+            Probe probe;
+            readProbe(bucket, probe);
+            if (probe.count < CAPACITY) {
+                writeSlot(bucket, probe.count, h, entry, probe.count + 1);
+                return true;
+            }
+            if (!split(bucket, probe)) return false;
+        }
+    }
+
+    bool erase(const Key& key) {
+        uint32_t h = mix(key.hash());
+        int bucket = bucketOf(h);
+        Probe probe;
+        Entry entry;
+        int i = locate(bucket, h, key, probe, entry);
+        if (i == -1) return false;
+        // The last entry takes the freed slot
+        int last = probe.count - 1;
+        if (i != last) bucketSegment.read(entryOffset(bucket, last), &entry, sizeof(Entry));
+        writeSlot(bucket, i, probe.hashes[last], entry, last);
+        return true;
+    }
+
+    long long memoryUsage() const override { return (1LL << globalDepth) * sizeof(int); }
+
+    void clear() {
+        dirSegment.clear();
+        bucketSegment.clear();
+        reset();
+    }
+};
+
+#endif
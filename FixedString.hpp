@@ -0,0 +1,107 @@
+#ifndef FIXEDSTRING_HPP
+#define FIXEDSTRING_HPP
+
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <ostream>
+
+// Fixed-capacity string key holding up to N characters.
+// Storage is zero-padded to a multiple of 8 bytes so comparisons run over
+// whole 64-bit words, and the hash is computed once on assignment. The type
+// is trivially copyable and can be written to disk as-is.
+template<int N>
+struct FixedString {
+    static constexpr int WORDS = (N + 8) / 8;
+    static constexpr int CAPACITY = WORDS * 8;
+
+    char data[CAPACITY];
+    uint32_t hashValue;
+
+    FixedString() : hashValue(0) {
+        memset(data, 0, sizeof(data));
+        hashValue = computeHash();
+    }
+
+    FixedString(const char* str) {
+        assign(str, strlen(str));
+    }
+
+    FixedString(const std::string& str) {
+        assign(str.c_str(), str.length());
+    }
+
+    void assign(const char* str, size_t len) {
+        if (len > static_cast<size_t>(N)) len = N;
+        memset(data, 0, sizeof(data));
+        memcpy(data, str, len);
+        hashValue = computeHash();
+    }
+
+    const char* c_str() const { return data; }
+    bool empty() const { return data[0] == '\0'; }
+    uint32_t hash() const { return hashValue; }
+
+    bool operator==(const FixedString& other) const {
+        if (hashValue != other.hashValue) return false;
+        for (int i = 0; i < WORDS; i++) {
+            if (word(i) != other.word(i)) return false;
+        }
+        return true;
+    }
+
+    bool operator!=(const FixedString& other) const { return !(*this == other); }
+
+    // Lexicographic order, identical to strcmp on the stored text
+    bool operator<(const FixedString& other) const {
+        for (int i = 0; i < WORDS; i++) {
+            uint64_t a = orderedWord(i), b = other.orderedWord(i);
+            if (a != b) return a < b;
+        }
+        return false;
+    }
+
+    bool operator>(const FixedString& other) const { return other < *this; }
+    bool operator<=(const FixedString& other) const { return !(other < *this); }
+    bool operator>=(const FixedString& other) const { return !(*this < other); }
+
+private:
+    uint64_t word(int i) const {
+        uint64_t w;
+        memcpy(&w, data + i * 8, 8);
+        return w;
+    }
+
+    // Word with the first character in the most significant byte
+    uint64_t orderedWord(int i) const {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        return __builtin_bswap64(word(i));
+#else
+        return word(i);
+#endif
+    }
+
+    // Word-at-a-time multiply-xorshift mix; far better spread than h * 131
+    uint32_t computeHash() const {
+        uint64_t h = 0x9E3779B97F4A7C15ULL;
+        for (int i = 0; i < WORDS; i++) {
+            h ^= word(i);
+            h *= 0xBF58476D1CE4E5B9ULL;
+            h ^= h >> 31;
+        }
+        h *= 0x94D049BB133111EBULL;
+        h ^= h >> 29;
+        return static_cast<uint32_t>(h);
+    }
+};
+
+typedef FixedString<20> UserName;
+typedef FixedString<20> TrainID;
+typedef FixedString<30> StationName;
+
+template<int N>
+std::ostream& operator<<(std::ostream& os, const FixedString<N>& str) {
+    return os << str.data;
+}
+
+#endif
@@ -0,0 +1,192 @@
+#ifndef HEAPFILE_HPP
+#define HEAPFILE_HPP
+
+#include <cstring>
+#include <string>
+#include "core.hpp"
+#include "Pager.hpp"
+#include "MemoryGovernor.hpp"
+
+// Variable-size records in slotted pages.
+//
+// The "<name>_pages" segment is a sequence of HEAP_PAGE-byte pages. Each
+// starts with a header and a slot array growing forward; record bytes are
+// packed from the end of the page backward. A record id names a page and a
+// slot and never changes while the record lives: when a page runs out of
+// contiguous room, its records are compacted toward the end and only the
+// slot offsets change. Erasing frees the slot and the bytes, and both are
+// reused by later inserts. Free bytes per page are kept in memory and
+// mirrored to "<name>_fsm", like ExtendibleHash's directory; an insert takes
+// the first page with room, so space from erased records is filled before
+// the file grows.
+class HeapFile : public MemoryConsumer {
+public:
+    static const int HEAP_PAGE = 4 * PAGE_SIZE;
+
+private:
+    struct Header {
+        int slotCount;
+        int dataStart;  // Lowest record byte in the page
+        int liveBytes;  // Bytes of live records
+    };
+
+    struct Slot {
+        int offset;
+        int length;  // -1: free
+    };
+
+    static const int SLOT_BITS = 16;
+
+public:
+    static const int MAX_RECORD = HEAP_PAGE - (int)sizeof(Header) - (int)sizeof(Slot);
+
+private:
+    Segment fsmSegment;
+    Segment pageSegment;
+    Array<int> freeBytes;  // Per page, slot array growth included
+
+    static int pageOf(long long rid) { return (int)(rid >> SLOT_BITS); }
+    static int slotOf(long long rid) { return (int)(rid & ((1 << SLOT_BITS) - 1)); }
+    static long long pageOffset(int page) { return (long long)page * HEAP_PAGE; }
+
+    static long long slotOffset(long long rid) {
+        return pageOffset(pageOf(rid)) + sizeof(Header) + (long long)slotOf(rid) * sizeof(Slot);
+    }
+
+    static int spaceLeft(const Header& header) {
+        return HEAP_PAGE - (int)sizeof(Header) - header.slotCount * (int)sizeof(Slot) - header.liveBytes;
+    }
+
+    void setFree(int page, int bytes) {
+        freeBytes[page] = bytes;
+        fsmSegment.write((long long)page * sizeof(int), &bytes, sizeof(int));
+    }
+
+    int appendPage() {
+        int page = freeBytes.size();
+        Header header;
+        header.slotCount = 0;
+        header.dataStart = HEAP_PAGE;
+        header.liveBytes = 0;
+        pageSegment.write(pageOffset(page), &header, sizeof(Header));
+        freeBytes.add(0);
+        setFree(page, spaceLeft(header));
+        return page;
+    }
+
+    // Moves every live record to the end of the page, closing the holes
+    void compact(int page, Header& header, Slot* slots) {
+        char* data = new char[HEAP_PAGE];
+        char* packed = new char[HEAP_PAGE];
+        pageSegment.read(pageOffset(page), data, HEAP_PAGE);
+        int end = HEAP_PAGE;
+        for (int i = 0; i < header.slotCount; i++) {
+            if (slots[i].length == -1) continue;
+            end -= slots[i].length;
+            memcpy(packed + end, data + slots[i].offset, slots[i].length);
+            slots[i].offset = end;
+        }
+        header.dataStart = end;
+        pageSegment.write(pageOffset(page) + end, packed + end, HEAP_PAGE - end);
+        delete[] data;
+        delete[] packed;
+    }
+
+public:
+    HeapFile(Pager& pager, const std::string& name)
+        : fsmSegment(pager, (name + "_fsm").c_str()), pageSegment(pager, (name + "_pages").c_str()) {
+        int pages = (int)(fsmSegment.size() / sizeof(int));
+        for (int i = 0; i < pages; i++) freeBytes.add(0);
+        if (pages > 0) fsmSegment.read(0, &freeBytes[0], pages * sizeof(int));
+    }
+
+    // Stores a record and returns its id; -1 if it is longer than MAX_RECORD
+    long long insert(const void* data, int length) {
+        if (length > MAX_RECORD) return -1;
+        int page = -1;
+        for (int p = 0; p < freeBytes.size() && page == -1; p++) {
+            if (freeBytes[p] >= length + (int)sizeof(Slot)) page = p;
+        }
+        if (page == -1) page = appendPage();
+
+        Header header;
+        pageSegment.read(pageOffset(page), &header, sizeof(Header));
+        Slot* slots = new Slot[header.slotCount + 1];
+        pageSegment.read(pageOffset(page) + sizeof(Header), slots, header.slotCount * sizeof(Slot));
+        int slot = 0;
+        while (slot < header.slotCount && slots[slot].length != -1) slot++;
+        int slotCount = slot == header.slotCount ? header.slotCount + 1 : header.slotCount;
+        int slotsEnd = (int)sizeof(Header) + slotCount * (int)sizeof(Slot);
+        if (header.dataStart - slotsEnd < length) compact(page, header, slots);
+
+        header.dataStart -= length;
+        header.slotCount = slotCount;
+        header.liveBytes += length;
+        slots[slot].offset = header.dataStart;
+        slots[slot].length = length;
+        pageSegment.write(pageOffset(page) + header.dataStart, data, length);
+        pageSegment.write(pageOffset(page) + sizeof(Header), slots, slotCount * sizeof(Slot));
+        pageSegment.write(pageOffset(page), &header, sizeof(Header));
+        setFree(page, spaceLeft(header));
+        delete[] slots;
+        return (long long)page << SLOT_BITS | slot;
+    }
+
+    // Copies record rid into buf and returns its length
+    int read(long long rid, void* buf) {
+        Slot slot;
+        pageSegment.read(slotOffset(rid), &slot, sizeof(Slot));
+        pageSegment.read(pageOffset(pageOf(rid)) + slot.offset, buf, slot.length);
+        return slot.length;
+    }
+
+    // Records rids[0..count) into buf, each right after the previous one.
+    // lengths are the records' lengths as the caller stored them. Slots and
+    // then records are fetched with one batched read each.
+    void readMany(const long long* rids, const int* lengths, int count, void* buf) {
+        long long* offsets = new long long[count > 0 ? count : 1];
+        int* slotLengths = new int[count > 0 ? count : 1];
+        Slot* slots = new Slot[count > 0 ? count : 1];
+        for (int i = 0; i < count; i++) {
+            offsets[i] = slotOffset(rids[i]);
+            slotLengths[i] = sizeof(Slot);
+        }
+        pageSegment.readBatch(offsets, slotLengths, count, slots);
+        for (int i = 0; i < count; i++) offsets[i] = pageOffset(pageOf(rids[i])) + slots[i].offset;
+        pageSegment.readBatch(offsets, lengths, count, buf);
+        delete[] offsets;
+        delete[] slotLengths;
+        delete[] slots;
+    }
+
+    void erase(long long rid) {
+        int page = pageOf(rid);
+        Header header;
+        pageSegment.read(pageOffset(page), &header, sizeof(Header));
+        Slot slot;
+        pageSegment.read(slotOffset(rid), &slot, sizeof(Slot));
+        header.liveBytes -= slot.length;
+        slot.length = -1;
+        pageSegment.write(slotOffset(rid), &slot, sizeof(Slot));
+        // Trailing free slots give their room back to the page
+        while (header.slotCount > 0) {
+            Slot last;
+            pageSegment.read(slotOffset((long long)page << SLOT_BITS | (header.slotCount - 1)), &last, sizeof(Slot));
+            if (last.length != -1) break;
+            header.slotCount--;
+        }
+        if (header.slotCount == 0) header.dataStart = HEAP_PAGE;
+        pageSegment.write(pageOffset(page), &header, sizeof(Header));
+        setFree(page, spaceLeft(header));
+    }
+
+    long long memoryUsage() const override { return (long long)freeBytes.capacity() * sizeof(int); }
+
+    void clear() {
+        fsmSegment.clear();
+        pageSegment.clear();
+        freeBytes.clear();
+    }
+};
+
+#endif
@@ -0,0 +1,184 @@
+#ifndef IORING_HPP
+#define IORING_HPP
+
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+// <linux/fs.h>, pulled in above, defines these as macros
+#undef BLOCK_SIZE
+#undef BLOCK_SIZE_BITS
+
+// Runs batches of positioned vector reads and writes.
+//
+// Once start() succeeds, a batch goes to the kernel through io_uring with a
+// single io_uring_enter, so every request of the batch is in flight at the
+// same time; run() returns when all of them have completed. The ring is set
+// up with raw syscalls, so there is no liburing dependency. Without a ring
+// (never started, or the kernel or a seccomp filter refused it) the same
+// batch runs as a loop of preadv/pwritev, and a request the ring fails is
+// retried that way too. One ring serves one thread at a time.
+class IoRing {
+public:
+    struct Request {
+        int fd;
+        bool write;
+        struct iovec* iov;
+        int iovCount;
+        off_t offset;
+        ssize_t result;  // Bytes moved, or -1
+    };
+
+private:
+    int ringFd;
+    unsigned int depth;
+
+    // Submission queue
+    void* sqMap;
+    size_t sqMapSize;
+    struct io_uring_sqe* sqes;
+    size_t sqesSize;
+    unsigned int* sqTail;
+    unsigned int* sqMask;
+    unsigned int* sqArray;
+
+    // Completion queue; shares sqMap with a single-mmap kernel
+    void* cqMap;
+    size_t cqMapSize;
+    unsigned int* cqHead;
+    unsigned int* cqTail;
+    unsigned int* cqMask;
+    struct io_uring_cqe* cqes;
+
+    static ssize_t runSync(Request& r) {
+        return r.write ? pwritev(r.fd, r.iov, r.iovCount, r.offset) : preadv(r.fd, r.iov, r.iovCount, r.offset);
+    }
+
+    // Submits up to depth requests and waits for all of their completions
+    void runRing(Request* requests, int count) {
+        unsigned int tail = *sqTail;
+        for (int i = 0; i < count; i++) {
+            unsigned int idx = tail & *sqMask;
+            struct io_uring_sqe* sqe = &sqes[idx];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = requests[i].write ? IORING_OP_WRITEV : IORING_OP_READV;
+            sqe->fd = requests[i].fd;
+            sqe->addr = (unsigned long long)(uintptr_t)requests[i].iov;
+            sqe->len = requests[i].iovCount;
+            sqe->off = requests[i].offset;
+            sqe->user_data = i;
+            sqArray[idx] = idx;
+            tail++;
+        }
+        __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+
+        int unsubmitted = count;
+        int pending = count;
+        while (pending > 0) {
+            int n = (int)syscall(__NR_io_uring_enter, ringFd, unsubmitted, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (n < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY && unsubmitted > 0) {
+                // The kernel took none of the remaining entries: take them
+                // back off the queue and run them here
+                tail -= unsubmitted;
+                __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+                for (int i = count - unsubmitted; i < count; i++) requests[i].result = runSync(requests[i]);
+                pending -= unsubmitted;
+                unsubmitted = 0;
+            }
+            if (n > 0) unsubmitted -= n;
+            unsigned int head = *cqHead;
+            while (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+                struct io_uring_cqe* cqe = &cqes[head & *cqMask];
+                Request& r = requests[cqe->user_data];
+                r.result = cqe->res >= 0 ? cqe->res : runSync(r);
+                pending--;
+                head++;
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        }
+    }
+
+    void stop() {
+        if (sqes) munmap(sqes, sqesSize);
+        if (cqMap && cqMap != sqMap) munmap(cqMap, cqMapSize);
+        if (sqMap) munmap(sqMap, sqMapSize);
+        if (ringFd != -1) close(ringFd);
+        ringFd = -1;
+        sqMap = cqMap = nullptr;
+        sqes = nullptr;
+    }
+
+public:
+    IoRing() : ringFd(-1), depth(0), sqMap(nullptr), sqMapSize(0), sqes(nullptr), sqesSize(0), cqMap(nullptr),
+               cqMapSize(0) {}
+
+    ~IoRing() { stop(); }
+
+    // Sets up a ring with room for entries requests; false means synchronous I/O
+    bool start(unsigned int entries) {
+        if (ringFd != -1) return true;
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        ringFd = (int)syscall(__NR_io_uring_setup, entries, &params);
+        if (ringFd < 0) {
+            ringFd = -1;
+            return false;
+        }
+        depth = params.sq_entries;
+        sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+        cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single && cqMapSize > sqMapSize) sqMapSize = cqMapSize;
+        sqMap = mmap(nullptr, sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                     IORING_OFF_SQ_RING);
+        if (sqMap == MAP_FAILED) {
+            sqMap = nullptr;
+            stop();
+            return false;
+        }
+        cqMap = single ? sqMap
+                       : mmap(nullptr, cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                              IORING_OFF_CQ_RING);
+        sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+        void* sqeMap = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                            IORING_OFF_SQES);
+        if (cqMap == MAP_FAILED || sqeMap == MAP_FAILED) {
+            if (cqMap == MAP_FAILED) cqMap = nullptr;
+            if (sqeMap != MAP_FAILED) munmap(sqeMap, sqesSize);
+            stop();
+            return false;
+        }
+        sqes = static_cast<struct io_uring_sqe*>(sqeMap);
+
+        char* sq = static_cast<char*>(sqMap);
+        sqTail = reinterpret_cast<unsigned int*>(sq + params.sq_off.tail);
+        sqMask = reinterpret_cast<unsigned int*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned int*>(sq + params.sq_off.array);
+        char* cq = static_cast<char*>(cqMap);
+        cqHead = reinterpret_cast<unsigned int*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned int*>(cq + params.cq_off.tail);
+        cqMask = reinterpret_cast<unsigned int*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    bool active() const { return ringFd != -1; }
+
+    // Runs every request and fills in its result
+    void run(Request* requests, int count) {
+        if (ringFd == -1) {
+            for (int i = 0; i < count; i++) requests[i].result = runSync(requests[i]);
+            return;
+        }
+        for (int i = 0; i < count; i += depth) {
+            runRing(requests + i, count - i < (int)depth ? count - i : (int)depth);
+        }
+    }
+};
+
+#endif
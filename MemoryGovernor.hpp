@@ -0,0 +1,173 @@
+#ifndef MEMORYGOVERNOR_HPP
+#define MEMORYGOVERNOR_HPP
+
+#include <ostream>
+
+const long long MEBIBYTE = 1LL << 20;
+
+// Anything whose memory the governor tracks. Caches also report hits and
+// misses and shrink or grow when given a new budget.
+class MemoryConsumer {
+public:
+    virtual ~MemoryConsumer() {}
+    virtual long long memoryUsage() const = 0;
+    virtual long long hitCount() const { return 0; }
+    virtual long long missCount() const { return 0; }
+    // Must evict down to bytes before returning
+    virtual void setMemoryBudget(long long bytes) { (void)bytes; }
+};
+
+// Central memory budget shared by every cache.
+//
+// Fixed allocations (static tables, bitmaps) and growable structures are
+// registered for accounting only. Caches get what is left of the limit:
+// each keeps its minimum, and the rest is split in proportion to recent
+// hits plus the misses seen while the cache was full. A cache that is not
+// full is capped at a quarter above its current use, so idle budget flows
+// to caches that are under pressure. Budgets only move when the change is
+// worth it, because resizing a cache can drop its contents.
+class MemoryGovernor {
+private:
+    static const int MAX_ACCOUNTS = 32;
+
+    struct Account {
+        const char* name;
+        MemoryConsumer* consumer;  // nullptr for a fixed allocation
+        long long fixedBytes;
+        bool resizable;
+        long long minBytes, maxBytes;
+        long long budget;
+        long long lastHits, lastMisses;
+    };
+
+    Account accounts[MAX_ACCOUNTS];
+    int accountCount;
+    long long limit;
+
+    // nullptr once every account is taken
+    Account* add(const char* name, MemoryConsumer* consumer, long long fixedBytes) {
+        if (accountCount == MAX_ACCOUNTS) return nullptr;
+        Account& a = accounts[accountCount++];
+        a.name = name;
+        a.consumer = consumer;
+        a.fixedBytes = fixedBytes;
+        a.resizable = false;
+        a.minBytes = a.maxBytes = a.budget = 0;
+        a.lastHits = a.lastMisses = 0;
+        return &a;
+    }
+
+    long long usageOf(const Account& a) const {
+        return a.consumer ? a.consumer->memoryUsage() : a.fixedBytes;
+    }
+
+public:
+    explicit MemoryGovernor(long long limitBytes) : accountCount(0), limit(limitBytes) {}
+
+    // The add functions return false, tracking nothing, once MAX_ACCOUNTS
+    // accounts are registered
+    bool addFixed(const char* name, long long bytes) {
+        return add(name, nullptr, bytes) != nullptr;
+    }
+
+    // Tracked but never resized
+    bool addConsumer(const char* name, MemoryConsumer* consumer) {
+        return add(name, consumer, 0) != nullptr;
+    }
+
+    bool addCache(const char* name, MemoryConsumer* consumer, long long minBytes, long long maxBytes) {
+        Account* a = add(name, consumer, 0);
+        if (!a) return false;
+        a->resizable = true;
+        a->minBytes = minBytes;
+        a->maxBytes = maxBytes;
+        a->budget = consumer->memoryUsage();
+        a->lastHits = consumer->hitCount();
+        a->lastMisses = consumer->missCount();
+        return true;
+    }
+
+    void setLimit(long long limitBytes) {
+        limit = limitBytes;
+        rebalance();
+    }
+
+    long long usage() const {
+        long long total = 0;
+        for (int i = 0; i < accountCount; i++) total += usageOf(accounts[i]);
+        return total;
+    }
+
+    void rebalance() {
+        long long available = limit;
+        long long weights[MAX_ACCOUNTS], wants[MAX_ACCOUNTS], budgets[MAX_ACCOUNTS];
+        for (int i = 0; i < accountCount; i++) {
+            Account& a = accounts[i];
+            if (!a.resizable) {
+                available -= usageOf(a);
+                continue;
+            }
+            long long used = a.consumer->memoryUsage();
+            long long hits = a.consumer->hitCount(), misses = a.consumer->missCount();
+            bool full = used * 10 >= a.budget * 9;
+            weights[i] = 1 + (hits - a.lastHits) + (full ? misses - a.lastMisses : 0);
+            a.lastHits = hits;
+            a.lastMisses = misses;
+            wants[i] = full ? a.maxBytes : used + used / 4;
+            if (wants[i] < a.minBytes) wants[i] = a.minBytes;
+            if (wants[i] > a.maxBytes) wants[i] = a.maxBytes;
+            budgets[i] = a.minBytes;
+            available -= a.minBytes;
+        }
+
+        // Water-fill the rest by weight; a capped cache hands its share on
+        bool open[MAX_ACCOUNTS];
+        for (int i = 0; i < accountCount; i++) open[i] = accounts[i].resizable && budgets[i] < wants[i];
+        while (available > 0) {
+            long long totalWeight = 0;
+            for (int i = 0; i < accountCount; i++) {
+                if (open[i]) totalWeight += weights[i];
+            }
+            if (totalWeight == 0) break;
+            long long handed = 0;
+            for (int i = 0; i < accountCount; i++) {
+                if (!open[i]) continue;
+                long long share = available * weights[i] / totalWeight;
+                if (share > wants[i] - budgets[i]) {
+                    share = wants[i] - budgets[i];
+                    open[i] = false;
+                }
+                budgets[i] += share;
+                handed += share;
+            }
+            if (handed == 0) break;
+            available -= handed;
+        }
+
+        for (int i = 0; i < accountCount; i++) {
+            Account& a = accounts[i];
+            if (!a.resizable) continue;
+            long long delta = budgets[i] > a.budget ? budgets[i] - a.budget : a.budget - budgets[i];
+            // Shrinking below current use is always applied; growth waits for a real change
+            bool overBudget = a.consumer->memoryUsage() > budgets[i];
+            if (!overBudget && delta * 8 < a.budget) continue;
+            a.budget = budgets[i];
+            a.consumer->setMemoryBudget(a.budget);
+        }
+    }
+
+    void report(std::ostream& out) const {
+        for (int i = 0; i < accountCount; i++) {
+            const Account& a = accounts[i];
+            out << a.name << ' ' << usageOf(a);
+            if (a.resizable) {
+                out << " budget " << a.budget << " hits " << a.consumer->hitCount()
+                    << " misses " << a.consumer->missCount();
+            }
+            out << '\n';
+        }
+        out << "total " << usage() << " limit " << limit << '\n';
+    }
+};
+
+#endif
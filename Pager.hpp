@@ -0,0 +1,905 @@
+#ifndef PAGER_HPP
+#define PAGER_HPP
+
+#include <cstring>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include "core.hpp"
+#include "MemoryGovernor.hpp"
+#include "IoRing.hpp"
+
+// Single-file paged storage.
+//
+// Page 0 is the superblock, which records the page allocator state and a
+// table of named segments. Each segment is a sparse, linearly addressed byte
+// space whose logical pages are mapped to physical pages through a chain of
+// map pages. All segments share one buffer pool of PAGE_SIZE frames with
+// clock eviction; dirty frames reach the file on eviction or flush(). The
+// pool size follows the budget given by the memory governor.
+//
+// With startWriteBack(), a background thread drains dirty frames instead:
+// it snapshots a batch under the pool lock, sorts it by page number and
+// writes runs of adjacent pages with one pwritev each. Frames in flight are
+// never evicted, so a newer copy cannot be overtaken by the older snapshot.
+// Writers block once the dirty count exceeds the configured budget.
+//
+// readBatch() is the read-side counterpart: it sorts many small reads by
+// offset and brings their missing pages in with one preadv per run of
+// adjacent physical pages.
+//
+// Batches of runs go through an IoRing. After useIoRing() they are
+// submitted to io_uring together, so all runs of a batch are in flight at
+// once; otherwise, or where io_uring is unavailable, they are issued one
+// after another with preadv/pwritev.
+//
+// useDirectIo() switches the file to O_DIRECT, so pages are cached only in
+// the pool and the memory budget covers all of the caching. Every transfer
+// then starts in a page-aligned buffer from newPageBuffer(): the frames, the
+// write-back staging area and the superblock page.
+
+const int PAGE_SIZE = 4096;
+const int MAX_SEGMENTS = 32;
+const int SEGMENT_NAME_LEN = 24;
+const int DEFAULT_POOL_PAGES = 1024;
+const int MIN_POOL_PAGES = 32;
+const int WRITE_BACK_BATCH = 64;
+const int READ_BATCH = 64;
+
+class Pager : public MemoryConsumer {
+private:
+    static constexpr unsigned int MAGIC = 0x54444231;  // "TDB1"
+    static constexpr int MAP_ENTRIES = PAGE_SIZE / sizeof(int) - 1;
+
+    struct SegmentInfo {
+        char name[SEGMENT_NAME_LEN];
+        int mapHead;  // First map page, -1 if the segment has no pages
+        int reserved;
+        long long size;  // High-water mark in bytes
+    };
+
+    struct Superblock {
+        unsigned int magic;
+        int pageCount;
+        int freeHead;  // Free pages are chained through their first int
+        int segmentCount;
+        SegmentInfo segments[MAX_SEGMENTS];
+    };
+
+    std::string filename;
+    int fd;
+    bool directIo;
+    Superblock super;
+    bool superDirty;
+    char* superPage;  // Aligned staging for the superblock
+
+    // Per-segment logical -> physical page map and the map pages holding it
+    Array<int> pageMaps[MAX_SEGMENTS];
+    Array<int> mapPages[MAX_SEGMENTS];
+
+    // Buffer pool
+    int poolPages;
+    char* frames;
+    int* framePage;
+    bool* frameDirty;
+    bool* frameRef;
+    int* chainNext;
+    int* bucketHead;
+    int bucketMask;
+    int clockHand;
+    int dirtyCount;
+    long long hits, misses;
+    long long diskRead, diskWritten;  // Bytes moved by pread/pwrite
+
+    // Background write-back
+    mutable std::mutex mutex;  // Also taken by the const accessors below
+    std::condition_variable flushWanted;
+    std::condition_variable flushDone;
+    std::thread flusher;
+    bool writeBack;
+    bool stopping;
+    bool batchInFlight;
+    int dirtyLimit;
+    int* dirtyQueue;  // Ring of frames that became dirty, in order
+    int queueHead, queueSize;
+    bool* frameInFlight;
+    bool* frameQueued;
+
+    // Batched I/O; ring is used under the pool lock, the write-back thread has its own
+    IoRing ring;
+    bool ioRingWanted;
+
+    char* frameData(int frame) { return frames + (long long)frame * PAGE_SIZE; }
+
+    static char* newPageBuffer(long long pages) {
+        void* buffer = nullptr;
+        if (posix_memalign(&buffer, PAGE_SIZE, pages * PAGE_SIZE) != 0) throw std::bad_alloc();
+        return static_cast<char*>(buffer);
+    }
+
+    static void deletePageBuffer(char* buffer) { free(buffer); }
+
+    int bucketOf(int page) const {
+        return (int)(((unsigned int)page * 2654435761u) & bucketMask);
+    }
+
+    int lookup(int page) const {
+        for (int f = bucketHead[bucketOf(page)]; f != -1; f = chainNext[f]) {
+            if (framePage[f] == page) return f;
+        }
+        return -1;
+    }
+
+    void unlink(int frame) {
+        int b = bucketOf(framePage[frame]);
+        int* link = &bucketHead[b];
+        while (*link != frame) link = &chainNext[*link];
+        *link = chainNext[frame];
+        framePage[frame] = -1;
+    }
+
+    void markDirty(int frame) {
+        if (frameDirty[frame]) return;
+        frameDirty[frame] = true;
+        dirtyCount++;
+        if (writeBack && !frameQueued[frame]) {
+            frameQueued[frame] = true;
+            dirtyQueue[(queueHead + queueSize) % poolPages] = frame;
+            queueSize++;
+        }
+    }
+
+    void writeFrame(int frame) {
+        ssize_t written = pwrite(fd, frameData(frame), PAGE_SIZE, (off_t)framePage[frame] * PAGE_SIZE);
+        if (written > 0) diskWritten += written;
+        frameDirty[frame] = false;
+        dirtyCount--;
+    }
+
+    // Writes pages[i] from data[i], pages sorted, with one request per run of
+    // adjacent pages; returns the bytes written
+    long long writePages(IoRing& io, const int* pages, char* const* data, int count) {
+        struct iovec iov[WRITE_BACK_BATCH];
+        IoRing::Request requests[WRITE_BACK_BATCH];
+        int requestCount = 0;
+        for (int i = 0; i < count;) {
+            int run = 0;
+            do {
+                iov[i + run].iov_base = data[i + run];
+                iov[i + run].iov_len = PAGE_SIZE;
+                run++;
+            } while (i + run < count && pages[i + run] == pages[i] + run);
+            requests[requestCount++] = IoRing::Request{fd, true, iov + i, run, (off_t)pages[i] * PAGE_SIZE, 0};
+            i += run;
+        }
+        io.run(requests, requestCount);
+        long long written = 0;
+        for (int r = 0; r < requestCount; r++) {
+            if (requests[r].result > 0) written += requests[r].result;
+        }
+        return written;
+    }
+
+    int evict() {
+        while (true) {
+            int f = clockHand;
+            clockHand = (clockHand + 1) % poolPages;
+            if (framePage[f] == -1) return f;
+            if (frameInFlight[f]) continue;
+            if (frameRef[f]) {
+                frameRef[f] = false;
+                continue;
+            }
+            if (frameDirty[f]) writeFrame(f);
+            unlink(f);
+            return f;
+        }
+    }
+
+    // Returns the frame holding page; a fresh page is zeroed instead of read
+    char* fetch(int page, bool fresh, bool forWrite) {
+        int f = lookup(page);
+        if (f == -1) {
+            misses++;
+            f = evict();
+            char* data = frameData(f);
+            if (fresh) {
+                memset(data, 0, PAGE_SIZE);
+            } else {
+                ssize_t n = pread(fd, data, PAGE_SIZE, (off_t)page * PAGE_SIZE);
+                if (n > 0) diskRead += n;
+                if (n < PAGE_SIZE) memset(data + (n > 0 ? n : 0), 0, PAGE_SIZE - (n > 0 ? n : 0));
+            }
+            framePage[f] = page;
+            int b = bucketOf(page);
+            chainNext[f] = bucketHead[b];
+            bucketHead[b] = f;
+        } else {
+            hits++;
+            if (fresh) memset(frameData(f), 0, PAGE_SIZE);
+        }
+        frameRef[f] = true;
+        if (forWrite || fresh) markDirty(f);
+        return frameData(f);
+    }
+
+    int allocatePage() {
+        superDirty = true;
+        if (super.freeHead != -1) {
+            int page = super.freeHead;
+            int next;
+            memcpy(&next, fetch(page, false, false), sizeof(int));
+            super.freeHead = next;
+            return page;
+        }
+        return super.pageCount++;
+    }
+
+    void freePage(int page) {
+        char* data = fetch(page, true, true);
+        memcpy(data, &super.freeHead, sizeof(int));
+        super.freeHead = page;
+        superDirty = true;
+    }
+
+    void loadMaps(int seg) {
+        pageMaps[seg].clear();
+        mapPages[seg].clear();
+        for (int mp = super.segments[seg].mapHead; mp != -1;) {
+            mapPages[seg].add(mp);
+            int entries[MAP_ENTRIES + 1];
+            memcpy(entries, fetch(mp, false, false), PAGE_SIZE);
+            for (int i = 1; i <= MAP_ENTRIES; i++) {
+                pageMaps[seg].add(entries[i]);
+            }
+            mp = entries[0];
+        }
+    }
+
+    // Records logical -> physical in both the in-memory map and its map page
+    void setMapping(int seg, int logical, int physical) {
+        int mapIdx = logical / MAP_ENTRIES;
+        while (mapPages[seg].size() <= mapIdx) {
+            int mp = allocatePage();
+            int* entries = reinterpret_cast<int*>(fetch(mp, true, true));
+            for (int i = 0; i <= MAP_ENTRIES; i++) entries[i] = -1;
+            int count = mapPages[seg].size();
+            if (count == 0) {
+                super.segments[seg].mapHead = mp;
+                superDirty = true;
+            } else {
+                int* prev = reinterpret_cast<int*>(fetch(mapPages[seg][count - 1], false, true));
+                prev[0] = mp;
+            }
+            mapPages[seg].add(mp);
+            for (int i = 0; i < MAP_ENTRIES; i++) pageMaps[seg].add(-1);
+        }
+        pageMaps[seg][logical] = physical;
+        int* entries = reinterpret_cast<int*>(fetch(mapPages[seg][mapIdx], false, true));
+        entries[1 + logical % MAP_ENTRIES] = physical;
+    }
+
+    // Frame, its bookkeeping and up to four hash buckets
+    static const int FRAME_BYTES = PAGE_SIZE + 3 * sizeof(int) + 4 * sizeof(bool) + 4 * sizeof(int);
+
+    long long mapMemory() const {
+        long long bytes = 0;
+        for (int i = 0; i < super.segmentCount; i++) {
+            bytes += (long long)(pageMaps[i].capacity() + mapPages[i].capacity()) * sizeof(int);
+        }
+        return bytes;
+    }
+
+    void allocatePool() {
+        frames = newPageBuffer(poolPages);
+        framePage = new int[poolPages];
+        frameDirty = new bool[poolPages];
+        frameInFlight = new bool[poolPages];
+        frameQueued = new bool[poolPages];
+        dirtyQueue = new int[poolPages];
+        frameRef = new bool[poolPages];
+        chainNext = new int[poolPages];
+        int buckets = 1;
+        while (buckets < poolPages * 2) buckets <<= 1;
+        bucketMask = buckets - 1;
+        bucketHead = new int[buckets];
+        resetPool();
+    }
+
+    void releasePool() {
+        deletePageBuffer(frames);
+        delete[] framePage;
+        delete[] frameDirty;
+        delete[] frameInFlight;
+        delete[] frameQueued;
+        delete[] dirtyQueue;
+        delete[] frameRef;
+        delete[] chainNext;
+        delete[] bucketHead;
+    }
+
+    void resetPool() {
+        for (int f = 0; f < poolPages; f++) {
+            framePage[f] = -1;
+            frameDirty[f] = false;
+            frameInFlight[f] = false;
+            frameQueued[f] = false;
+            frameRef[f] = false;
+            chainNext[f] = -1;
+        }
+        for (int b = 0; b <= bucketMask; b++) bucketHead[b] = -1;
+    }
+
+    template<typename T>
+    static void resizeArray(T*& array, int oldSize, int newSize) {
+        T* resized = new T[newSize];
+        memcpy(resized, array, (oldSize < newSize ? oldSize : newSize) * sizeof(T));
+        delete[] array;
+        array = resized;
+    }
+
+    // Changes the pool to pages frames, keeping the cached pages that fit.
+    // Shrinking drops clean frames past the new end and moves dirty ones
+    // into empty or clean frames below it; a dirty page is written out only
+    // when every frame below the end is dirty. Growing adds empty frames.
+    void resizePool(int pages, std::unique_lock<std::mutex>& lock) {
+        // Frames of a write-back batch are named by index until it lands
+        flushDone.wait(lock, [this] { return !batchInFlight; });
+        int target = 0;
+        for (int f = pages; f < poolPages; f++) {
+            if (framePage[f] == -1 || !frameDirty[f]) continue;
+            while (target < pages && framePage[target] != -1 && frameDirty[target]) target++;
+            if (target == pages) {
+                writeFrame(f);
+                continue;
+            }
+            memcpy(frameData(target), frameData(f), PAGE_SIZE);
+            framePage[target] = framePage[f];
+            frameDirty[target] = true;
+            frameRef[target] = frameRef[f];
+        }
+
+        char* resized = newPageBuffer(pages);
+        memcpy(resized, frames, (long long)(pages < poolPages ? pages : poolPages) * PAGE_SIZE);
+        deletePageBuffer(frames);
+        frames = resized;
+        resizeArray(framePage, poolPages, pages);
+        resizeArray(frameDirty, poolPages, pages);
+        resizeArray(frameInFlight, poolPages, pages);
+        resizeArray(frameQueued, poolPages, pages);
+        resizeArray(frameRef, poolPages, pages);
+        resizeArray(chainNext, poolPages, pages);
+        delete[] dirtyQueue;
+        dirtyQueue = new int[pages];
+        for (int f = poolPages; f < pages; f++) {
+            framePage[f] = -1;
+            frameDirty[f] = false;
+            frameRef[f] = false;
+        }
+        poolPages = pages;
+        if (clockHand >= poolPages) clockHand = 0;
+
+        // Rehash and requeue what is left
+        int buckets = 1;
+        while (buckets < poolPages * 2) buckets <<= 1;
+        bucketMask = buckets - 1;
+        delete[] bucketHead;
+        bucketHead = new int[buckets];
+        for (int b = 0; b <= bucketMask; b++) bucketHead[b] = -1;
+        queueHead = queueSize = 0;
+        for (int f = 0; f < poolPages; f++) {
+            frameInFlight[f] = false;
+            frameQueued[f] = false;
+            chainNext[f] = -1;
+            if (framePage[f] == -1) continue;
+            int b = bucketOf(framePage[f]);
+            chainNext[f] = bucketHead[b];
+            bucketHead[b] = f;
+            if (writeBack && frameDirty[f]) {
+                frameQueued[f] = true;
+                dirtyQueue[queueSize++] = f;
+            }
+        }
+    }
+
+    void initSuperblock() {
+        memset(&super, 0, sizeof(super));
+        super.magic = MAGIC;
+        super.pageCount = 1;
+        super.freeHead = -1;
+        super.segmentCount = 0;
+        superDirty = true;
+    }
+
+    void writeSuperblock() {
+        memset(superPage, 0, PAGE_SIZE);
+        memcpy(superPage, &super, sizeof(super));
+        ssize_t written = pwrite(fd, superPage, PAGE_SIZE, 0);
+        if (written > 0) diskWritten += written;
+        superDirty = false;
+    }
+
+    void flushLocked(std::unique_lock<std::mutex>& lock) {
+        flushDone.wait(lock, [this] { return !batchInFlight; });
+        // Dirty frames in batches, each sorted by page number
+        int pages[WRITE_BACK_BATCH];
+        char* data[WRITE_BACK_BATCH];
+        int count = 0;
+        for (int f = 0; f <= poolPages; f++) {
+            if (f < poolPages && (framePage[f] == -1 || !frameDirty[f])) continue;
+            if (f == poolPages || count == WRITE_BACK_BATCH) {
+                diskWritten += writePages(ring, pages, data, count);
+                count = 0;
+                if (f == poolPages) break;
+            }
+            int j = count++;
+            while (j > 0 && pages[j - 1] > framePage[f]) {
+                pages[j] = pages[j - 1];
+                data[j] = data[j - 1];
+                j--;
+            }
+            pages[j] = framePage[f];
+            data[j] = frameData(f);
+            frameDirty[f] = false;
+            dirtyCount--;
+        }
+        for (int f = 0; f < poolPages; f++) frameQueued[f] = false;
+        queueHead = queueSize = 0;
+        if (superDirty) writeSuperblock();
+    }
+
+    // Blocks the caller while the dirty set is over budget
+    void throttle(std::unique_lock<std::mutex>& lock) {
+        if (!writeBack || dirtyCount <= dirtyLimit) return;
+        flushWanted.notify_one();
+        flushDone.wait(lock, [this] { return dirtyCount <= dirtyLimit / 2 || stopping; });
+    }
+
+    void writeBackLoop() {
+        char* staging = newPageBuffer(WRITE_BACK_BATCH);
+        int pages[WRITE_BACK_BATCH];
+        int frameOf[WRITE_BACK_BATCH];
+        int order[WRITE_BACK_BATCH];
+        int sortedPages[WRITE_BACK_BATCH];
+        char* sortedData[WRITE_BACK_BATCH];
+        IoRing flusherRing;
+        bool ringStarted = false;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            flushWanted.wait_for(lock, std::chrono::milliseconds(20),
+                                 [this] { return stopping || dirtyCount > dirtyLimit / 4; });
+            if (queueSize == 0) {
+                if (stopping) break;
+                continue;
+            }
+
+            // Snapshot up to a batch of frames that are still dirty
+            int count = 0;
+            while (queueSize > 0 && count < WRITE_BACK_BATCH) {
+                int f = dirtyQueue[queueHead];
+                queueHead = (queueHead + 1) % poolPages;
+                queueSize--;
+                frameQueued[f] = false;
+                if (framePage[f] == -1 || !frameDirty[f] || frameInFlight[f]) continue;
+                memcpy(staging + (long long)count * PAGE_SIZE, frameData(f), PAGE_SIZE);
+                pages[count] = framePage[f];
+                frameOf[count] = f;
+                frameDirty[f] = false;
+                frameInFlight[f] = true;
+                dirtyCount--;
+                count++;
+            }
+            batchInFlight = true;
+            if (ioRingWanted && !ringStarted) {
+                ringStarted = true;
+                flusherRing.start(WRITE_BACK_BATCH);
+            }
+            lock.unlock();
+
+            // Insertion sort by page number, then one pwritev per run of adjacent pages
+            for (int i = 0; i < count; i++) {
+                int j = i;
+                while (j > 0 && pages[order[j - 1]] > pages[i]) {
+                    order[j] = order[j - 1];
+                    j--;
+                }
+                order[j] = i;
+            }
+            for (int i = 0; i < count; i++) {
+                sortedPages[i] = pages[order[i]];
+                sortedData[i] = staging + (long long)order[i] * PAGE_SIZE;
+            }
+            long long batchWritten = writePages(flusherRing, sortedPages, sortedData, count);
+
+            lock.lock();
+            diskWritten += batchWritten;
+            for (int i = 0; i < count; i++) frameInFlight[frameOf[i]] = false;
+            batchInFlight = false;
+            flushDone.notify_all();
+        }
+        deletePageBuffer(staging);
+    }
+
+    // Stable bottom-up merge sort of range indices by offset
+    static void sortByOffset(int* order, int count, const long long* offsets) {
+        int* scratch = new int[count > 0 ? count : 1];
+        for (int width = 1; width < count; width *= 2) {
+            for (int lo = 0; lo < count; lo += 2 * width) {
+                int mid = lo + width < count ? lo + width : count;
+                int hi = lo + 2 * width < count ? lo + 2 * width : count;
+                int a = lo, b = mid, k = lo;
+                while (a < mid && b < hi) {
+                    scratch[k++] = offsets[order[b]] < offsets[order[a]] ? order[b++] : order[a++];
+                }
+                while (a < mid) scratch[k++] = order[a++];
+                while (b < hi) scratch[k++] = order[b++];
+            }
+            memcpy(order, scratch, count * sizeof(int));
+        }
+        delete[] scratch;
+    }
+
+    // Reads pages, none of them pooled, into fresh frames with one preadv per
+    // run of adjacent pages. The frames stay in flight, so they cannot be
+    // evicted, until the caller releases them.
+    void loadPages(int* pages, int* frameOf, int count) {
+        for (int i = 1; i < count; i++) {
+            int page = pages[i];
+            int j = i;
+            while (j > 0 && pages[j - 1] > page) {
+                pages[j] = pages[j - 1];
+                j--;
+            }
+            pages[j] = page;
+        }
+        for (int i = 0; i < count; i++) {
+            int f = evict();
+            framePage[f] = pages[i];
+            int b = bucketOf(pages[i]);
+            chainNext[f] = bucketHead[b];
+            bucketHead[b] = f;
+            frameRef[f] = true;
+            frameInFlight[f] = true;
+            frameOf[i] = f;
+            misses++;
+        }
+        struct iovec iov[READ_BATCH];
+        IoRing::Request requests[READ_BATCH];
+        int runStart[READ_BATCH];
+        int requestCount = 0;
+        for (int i = 0; i < count;) {
+            int run = 0;
+            do {
+                iov[i + run].iov_base = frameData(frameOf[i + run]);
+                iov[i + run].iov_len = PAGE_SIZE;
+                run++;
+            } while (i + run < count && pages[i + run] == pages[i] + run);
+            runStart[requestCount] = i;
+            requests[requestCount++] = IoRing::Request{fd, false, iov + i, run, (off_t)pages[i] * PAGE_SIZE, 0};
+            i += run;
+        }
+        ring.run(requests, requestCount);
+        for (int r = 0; r < requestCount; r++) {
+            ssize_t n = requests[r].result;
+            if (n > 0) diskRead += n;
+            // Pages past the end of the file read back as zeros
+            long long left = n > 0 ? n : 0;
+            for (int i = 0; i < requests[r].iovCount; i++, left -= PAGE_SIZE) {
+                int got = left <= 0 ? 0 : left >= PAGE_SIZE ? PAGE_SIZE : (int)left;
+                if (got < PAGE_SIZE) memset(frameData(frameOf[runStart[r] + i]) + got, 0, PAGE_SIZE - got);
+            }
+        }
+    }
+
+    // Like read(), for pages already counted by readBatch()
+    void copyOut(int seg, long long offset, char* out, int len) {
+        while (len > 0) {
+            int logical = (int)(offset / PAGE_SIZE);
+            int inPage = (int)(offset % PAGE_SIZE);
+            int chunk = PAGE_SIZE - inPage < len ? PAGE_SIZE - inPage : len;
+            int physical = logical < pageMaps[seg].size() ? pageMaps[seg][logical] : -1;
+            if (physical == -1) {
+                memset(out, 0, chunk);
+            } else {
+                int f = lookup(physical);
+                memcpy(out, (f != -1 ? frameData(f) : fetch(physical, false, false)) + inPage, chunk);
+            }
+            out += chunk;
+            offset += chunk;
+            len -= chunk;
+        }
+    }
+
+public:
+    Pager(const std::string& fname, int pages = DEFAULT_POOL_PAGES)
+        : filename(fname), directIo(false), superDirty(false), poolPages(pages), clockHand(0), dirtyCount(0), hits(0), misses(0),
+          diskRead(0), diskWritten(0), writeBack(false), stopping(false), batchInFlight(false),
+          dirtyLimit(pages / 2), queueHead(0), queueSize(0), ioRingWanted(false) {
+        allocatePool();
+        superPage = newPageBuffer(1);
+
+        fd = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+        if (pread(fd, superPage, PAGE_SIZE, 0) == PAGE_SIZE) {
+            memcpy(&super, superPage, sizeof(super));
+        } else {
+            super.magic = 0;
+        }
+        if (super.magic != MAGIC) {
+            int truncated = ftruncate(fd, 0);
+            (void)truncated;
+            initSuperblock();
+        }
+        for (int i = 0; i < super.segmentCount; i++) {
+            loadMaps(i);
+        }
+    }
+
+    ~Pager() {
+        if (writeBack) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            flushWanted.notify_one();
+            flusher.join();
+        }
+        flush();
+        close(fd);
+        releasePool();
+        deletePageBuffer(superPage);
+    }
+
+    // Returns the id of the named segment, creating it if needed
+    int openSegment(const char* name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int i = 0; i < super.segmentCount; i++) {
+            if (strcmp(super.segments[i].name, name) == 0) return i;
+        }
+        if (super.segmentCount == MAX_SEGMENTS) return -1;
+        int id = super.segmentCount++;
+        SegmentInfo& info = super.segments[id];
+        memset(&info, 0, sizeof(info));
+        strncpy(info.name, name, SEGMENT_NAME_LEN - 1);
+        info.mapHead = -1;
+        info.size = 0;
+        pageMaps[id].clear();
+        mapPages[id].clear();
+        superDirty = true;
+        return id;
+    }
+
+    long long segmentSize(int seg) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return super.segments[seg].size;
+    }
+
+    // Reads len bytes; unwritten ranges read back as zeros
+    void read(int seg, long long offset, void* buf, int len) {
+        std::lock_guard<std::mutex> lock(mutex);
+        char* out = static_cast<char*>(buf);
+        while (len > 0) {
+            int logical = (int)(offset / PAGE_SIZE);
+            int inPage = (int)(offset % PAGE_SIZE);
+            int chunk = PAGE_SIZE - inPage < len ? PAGE_SIZE - inPage : len;
+            int physical = logical < pageMaps[seg].size() ? pageMaps[seg][logical] : -1;
+            if (physical == -1) {
+                memset(out, 0, chunk);
+            } else {
+                memcpy(out, fetch(physical, false, false) + inPage, chunk);
+            }
+            out += chunk;
+            offset += chunk;
+            len -= chunk;
+        }
+    }
+
+    // Reads count ranges into buf, each right after the previous one. The
+    // ranges are visited in offset order; the pages they miss are read in
+    // chunks of up to READ_BATCH, sorted by page number.
+    void readBatch(int seg, const long long* offsets, const int* lengths, int count, void* buf) {
+        std::lock_guard<std::mutex> lock(mutex);
+        char* out = static_cast<char*>(buf);
+        long long* dest = new long long[count > 0 ? count : 1];
+        int* order = new int[count > 0 ? count : 1];
+        long long at = 0;
+        for (int i = 0; i < count; i++) {
+            dest[i] = at;
+            at += lengths[i];
+        }
+        for (int i = 0; i < count; i++) order[i] = i;
+        sortByOffset(order, count, offsets);
+
+        // Keep most of the pool evictable while a chunk is in flight
+        int limit = poolPages / 4 < READ_BATCH ? poolPages / 4 : READ_BATCH;
+        int pages[READ_BATCH];
+        int frameOf[READ_BATCH];
+        int pending = 0;
+        int copied = 0;  // Ranges of order[] already copied out
+        int lastLogical = -1;
+        auto finishChunk = [&](int upTo) {
+            loadPages(pages, frameOf, pending);
+            for (; copied < upTo; copied++) {
+                int r = order[copied];
+                copyOut(seg, offsets[r], out + dest[r], lengths[r]);
+            }
+            for (int i = 0; i < pending; i++) frameInFlight[frameOf[i]] = false;
+            pending = 0;
+        };
+        for (int k = 0; k < count; k++) {
+            int r = order[k];
+            if (lengths[r] <= 0) continue;
+            int first = (int)(offsets[r] / PAGE_SIZE);
+            int last = (int)((offsets[r] + lengths[r] - 1) / PAGE_SIZE);
+            for (int logical = first > lastLogical ? first : lastLogical + 1; logical <= last; logical++) {
+                lastLogical = logical;
+                int physical = logical < pageMaps[seg].size() ? pageMaps[seg][logical] : -1;
+                if (physical == -1) continue;
+                int f = lookup(physical);
+                if (f != -1) {
+                    hits++;
+                    frameRef[f] = true;
+                    continue;
+                }
+                if (pending == limit) finishChunk(k);
+                pages[pending++] = physical;
+            }
+        }
+        finishChunk(count);
+        delete[] dest;
+        delete[] order;
+    }
+
+    void write(int seg, long long offset, const void* buf, int len) {
+        std::unique_lock<std::mutex> lock(mutex);
+        const char* in = static_cast<const char*>(buf);
+        long long end = offset + len;
+        while (len > 0) {
+            int logical = (int)(offset / PAGE_SIZE);
+            int inPage = (int)(offset % PAGE_SIZE);
+            int chunk = PAGE_SIZE - inPage < len ? PAGE_SIZE - inPage : len;
+            int physical = logical < pageMaps[seg].size() ? pageMaps[seg][logical] : -1;
+            char* data;
+            if (physical == -1) {
+                physical = allocatePage();
+                setMapping(seg, logical, physical);
+                data = fetch(physical, true, true);
+            } else {
+                data = fetch(physical, false, true);
+            }
+            memcpy(data + inPage, in, chunk);
+            in += chunk;
+            offset += chunk;
+            len -= chunk;
+        }
+        if (end > super.segments[seg].size) {
+            super.segments[seg].size = end;
+            superDirty = true;
+        }
+        throttle(lock);
+    }
+
+    // Returns every page of the segment to the free list
+    void clearSegment(int seg) {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (int i = 0; i < pageMaps[seg].size(); i++) {
+            if (pageMaps[seg][i] != -1) freePage(pageMaps[seg][i]);
+        }
+        for (int i = 0; i < mapPages[seg].size(); i++) {
+            freePage(mapPages[seg][i]);
+        }
+        pageMaps[seg].clear();
+        mapPages[seg].clear();
+        super.segments[seg].mapHead = -1;
+        super.segments[seg].size = 0;
+        superDirty = true;
+        throttle(lock);
+    }
+
+    void flush() {
+        std::unique_lock<std::mutex> lock(mutex);
+        flushLocked(lock);
+    }
+
+    // Resizes the pool in place; cached pages stay cached where they fit
+    void setMemoryBudget(long long bytes) override {
+        std::unique_lock<std::mutex> lock(mutex);
+        int pages = (int)((bytes - mapMemory()) / FRAME_BYTES);
+        if (pages < MIN_POOL_PAGES) pages = MIN_POOL_PAGES;
+        if (pages == poolPages) return;
+        resizePool(pages, lock);
+        if (dirtyLimit >= poolPages) dirtyLimit = poolPages / 2;
+    }
+
+    long long memoryUsage() const override {
+        std::lock_guard<std::mutex> lock(mutex);
+        return (long long)poolPages * FRAME_BYTES + mapMemory();
+    }
+
+    long long hitCount() const override {
+        std::lock_guard<std::mutex> lock(mutex);
+        return hits;
+    }
+
+    long long missCount() const override {
+        std::lock_guard<std::mutex> lock(mutex);
+        return misses;
+    }
+
+    long long diskBytesRead() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return diskRead;
+    }
+
+    long long diskBytesWritten() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return diskWritten;
+    }
+
+    // Sends batched reads and writes through io_uring; false if the kernel
+    // refuses it, in which case they stay synchronous
+    bool useIoRing() {
+        std::lock_guard<std::mutex> lock(mutex);
+        ioRingWanted = ring.start(READ_BATCH > WRITE_BACK_BATCH ? READ_BATCH : WRITE_BACK_BATCH);
+        return ioRingWanted;
+    }
+
+    // Bypasses the OS page cache from now on; false if the file system
+    // refuses O_DIRECT, in which case I/O stays buffered
+    bool useDirectIo() {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (directIo) return true;
+        flushLocked(lock);
+        if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_DIRECT) == -1) return false;
+        // Drop what the kernel already caches, so reads really come from the disk
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        directIo = true;
+        return true;
+    }
+
+    // Hands dirty pages to a background writer; dirtyBudget caps how many
+    // pages may be dirty before writers wait (default: half the pool)
+    void startWriteBack(int dirtyBudget = -1) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (writeBack) return;
+        if (dirtyBudget > 0 && dirtyBudget < poolPages) dirtyLimit = dirtyBudget;
+        // Queue the pages that are already dirty
+        for (int f = 0; f < poolPages; f++) {
+            if (framePage[f] != -1 && frameDirty[f] && !frameQueued[f]) {
+                frameQueued[f] = true;
+                dirtyQueue[(queueHead + queueSize++) % poolPages] = f;
+            }
+        }
+        writeBack = true;
+        flusher = std::thread(&Pager::writeBackLoop, this);
+    }
+};
+
+// Handle to one named segment of a Pager
+class Segment {
+private:
+    Pager* pager;
+    int id;
+
+public:
+    Segment(Pager& p, const char* name) : pager(&p), id(p.openSegment(name)) {}
+
+    void read(long long offset, void* buf, int len) { pager->read(id, offset, buf, len); }
+    void readBatch(const long long* offsets, const int* lengths, int count, void* buf) {
+        pager->readBatch(id, offsets, lengths, count, buf);
+    }
+    void write(long long offset, const void* buf, int len) { pager->write(id, offset, buf, len); }
+    long long size() const { return pager->segmentSize(id); }
+    void clear() { pager->clearSegment(id); }
+};
+
+#endif
@@ -0,0 +1,375 @@
+#ifndef QUERYCACHE_HPP
+#define QUERYCACHE_HPP
+
+#include <cstring>
+#include <string>
+#include "FixedString.hpp"
+#include "MemoryGovernor.hpp"
+
+// A released train that runs from one station to a later one
+struct CandidateTrain {
+    int trainPos;
+    int fromIdx;
+    int toIdx;
+};
+
+// Bounded LRU cache for query_ticket.
+//
+// Two kinds of entries share one table and one byte budget:
+//   - candidate sets, keyed by (from, to): trains serving the pair;
+//   - formatted results, keyed by (from, to, day, sort).
+// Entries are indexed by their from-station so release_train can drop
+// exactly the pairs the new train serves. Result entries also register
+// every (train, start day) they print, so a seat change drops exactly the
+// results showing that train run.
+class QueryCache : public MemoryConsumer {
+private:
+    static const int MAX_ENTRIES = 2048;
+    static const int LOOKUP_BUCKETS = 4096;
+    static const int STATION_BUCKETS = 1024;
+    static const int DEP_BUCKETS = 8192;
+    static const int MIN_DEP_CAPACITY = 1024;
+
+    struct Entry {
+        bool used;
+        bool isResult;
+        StationName from, to;
+        int day;
+        bool byCost;
+        int bytes;
+        int lookupNext;
+        int stationPrev, stationNext;
+        int lruPrev, lruNext;
+        CandidateTrain* candidates;
+        int candidateCount;
+        std::string output;
+        int* deps;  // Dependency node ids of a result entry
+        int depCount;
+    };
+
+    // Dependency of a result entry on one (train, start day)
+    struct DepNode {
+        int trainPos;
+        int startDay;
+        int entry;
+        int prev, next;
+    };
+
+    Entry* entries;
+    int lookupHead[LOOKUP_BUCKETS];
+    int stationHead[STATION_BUCKETS];
+    int depHead[DEP_BUCKETS];
+    int freeEntry;
+    int lruHead, lruTail;  // Most and least recently used
+
+    DepNode* depNodes;
+    int depCapacity;
+    int depLive;
+    int freeDep;
+
+    long long bytesUsed;  // Entry table and entries; a result entry pays for its live dependency nodes
+    long long budget;
+    long long hits, misses;
+
+    static unsigned int keyHash(const StationName& from, const StationName& to, int day, bool byCost) {
+        unsigned int h = from.hash() * 0x9E3779B1u ^ to.hash();
+        h = h * 31 + (unsigned int)day;
+        h = h * 2 + (byCost ? 1 : 0);
+        return h;
+    }
+
+    static int depBucket(int trainPos, int startDay) {
+        return (int)(((unsigned int)trainPos * 92821u + (unsigned int)startDay) % DEP_BUCKETS);
+    }
+
+    void lruUnlink(int e) {
+        Entry& entry = entries[e];
+        if (entry.lruPrev != -1) entries[entry.lruPrev].lruNext = entry.lruNext;
+        else lruHead = entry.lruNext;
+        if (entry.lruNext != -1) entries[entry.lruNext].lruPrev = entry.lruPrev;
+        else lruTail = entry.lruPrev;
+    }
+
+    void lruPushFront(int e) {
+        entries[e].lruPrev = -1;
+        entries[e].lruNext = lruHead;
+        if (lruHead != -1) entries[lruHead].lruPrev = e;
+        lruHead = e;
+        if (lruTail == -1) lruTail = e;
+    }
+
+    int allocDep() {
+        if (freeDep == -1) {
+            int newCapacity = depCapacity == 0 ? MIN_DEP_CAPACITY : depCapacity * 2;
+            DepNode* grown = new DepNode[newCapacity];
+            if (depCapacity > 0) memcpy(grown, depNodes, sizeof(DepNode) * depCapacity);
+            delete[] depNodes;
+            depNodes = grown;
+            for (int i = newCapacity - 1; i >= depCapacity; i--) {
+                depNodes[i].next = freeDep;
+                freeDep = i;
+            }
+            depCapacity = newCapacity;
+        }
+        int d = freeDep;
+        freeDep = depNodes[d].next;
+        depLive++;
+        return d;
+    }
+
+    // Moves the live nodes into an array twice their number once three
+    // quarters of it are free, renumbering them in their entries
+    void compactDeps() {
+        if (depCapacity <= MIN_DEP_CAPACITY || depLive * 4 >= depCapacity) return;
+        int newCapacity = MIN_DEP_CAPACITY;
+        while (newCapacity < depLive * 2) newCapacity *= 2;
+        DepNode* compacted = new DepNode[newCapacity];
+        for (int b = 0; b < DEP_BUCKETS; b++) depHead[b] = -1;
+        int count = 0;
+        for (int e = 0; e < MAX_ENTRIES; e++) {
+            Entry& entry = entries[e];
+            if (!entry.used) continue;
+            for (int i = 0; i < entry.depCount; i++) {
+                DepNode& node = compacted[count];
+                node = depNodes[entry.deps[i]];
+                int b = depBucket(node.trainPos, node.startDay);
+                node.prev = -1;
+                node.next = depHead[b];
+                if (depHead[b] != -1) compacted[depHead[b]].prev = count;
+                depHead[b] = count;
+                entry.deps[i] = count++;
+            }
+        }
+        freeDep = -1;
+        for (int i = newCapacity - 1; i >= count; i--) {
+            compacted[i].next = freeDep;
+            freeDep = i;
+        }
+        delete[] depNodes;
+        depNodes = compacted;
+        depCapacity = newCapacity;
+    }
+
+    void releaseDep(int d) {
+        DepNode& node = depNodes[d];
+        int b = depBucket(node.trainPos, node.startDay);
+        if (node.prev != -1) depNodes[node.prev].next = node.next;
+        else depHead[b] = node.next;
+        if (node.next != -1) depNodes[node.next].prev = node.prev;
+        node.next = freeDep;
+        freeDep = d;
+        depLive--;
+    }
+
+    void remove(int e) {
+        Entry& entry = entries[e];
+        unsigned int h = keyHash(entry.from, entry.to, entry.day, entry.byCost) % LOOKUP_BUCKETS;
+        int* link = &lookupHead[h];
+        while (*link != e) link = &entries[*link].lookupNext;
+        *link = entry.lookupNext;
+
+        int sb = entry.from.hash() % STATION_BUCKETS;
+        if (entry.stationPrev != -1) entries[entry.stationPrev].stationNext = entry.stationNext;
+        else stationHead[sb] = entry.stationNext;
+        if (entry.stationNext != -1) entries[entry.stationNext].stationPrev = entry.stationPrev;
+
+        lruUnlink(e);
+
+        for (int i = 0; i < entry.depCount; i++) releaseDep(entry.deps[i]);
+        delete[] entry.deps;
+        delete[] entry.candidates;
+        entry.deps = nullptr;
+        entry.candidates = nullptr;
+        entry.depCount = entry.candidateCount = 0;
+        std::string().swap(entry.output);
+
+        bytesUsed -= entry.bytes;
+        entry.used = false;
+        entry.lookupNext = freeEntry;
+        freeEntry = e;
+        compactDeps();
+    }
+
+    int find(const StationName& from, const StationName& to, int day, bool byCost, bool isResult) {
+        unsigned int h = keyHash(from, to, day, byCost) % LOOKUP_BUCKETS;
+        for (int e = lookupHead[h]; e != -1; e = entries[e].lookupNext) {
+            const Entry& entry = entries[e];
+            if (entry.isResult == isResult && entry.day == day && entry.byCost == byCost &&
+                entry.from == from && entry.to == to) {
+                lruUnlink(e);
+                lruPushFront(e);
+                hits++;
+                return e;
+            }
+        }
+        misses++;
+        return -1;
+    }
+
+    // Makes room for bytes more and returns a linked, empty entry
+    int insert(const StationName& from, const StationName& to, int day, bool byCost, bool isResult, int bytes) {
+        while (lruTail != -1 && (freeEntry == -1 || bytesUsed + bytes > budget)) {
+            remove(lruTail);
+        }
+        int e = freeEntry;
+        Entry& entry = entries[e];
+        freeEntry = entry.lookupNext;
+
+        entry.used = true;
+        entry.isResult = isResult;
+        entry.from = from;
+        entry.to = to;
+        entry.day = day;
+        entry.byCost = byCost;
+        entry.bytes = bytes;
+        bytesUsed += bytes;
+
+        unsigned int h = keyHash(from, to, day, byCost) % LOOKUP_BUCKETS;
+        entry.lookupNext = lookupHead[h];
+        lookupHead[h] = e;
+
+        int sb = from.hash() % STATION_BUCKETS;
+        entry.stationPrev = -1;
+        entry.stationNext = stationHead[sb];
+        if (stationHead[sb] != -1) entries[stationHead[sb]].stationPrev = e;
+        stationHead[sb] = e;
+
+        lruPushFront(e);
+        return e;
+    }
+
+    bool cacheable(long long bytes) const { return bytes <= budget / 4; }
+
+    void reset() {
+        for (int i = 0; i < MAX_ENTRIES; i++) {
+            entries[i].used = false;
+            entries[i].candidates = nullptr;
+            entries[i].candidateCount = 0;
+            entries[i].deps = nullptr;
+            entries[i].depCount = 0;
+            entries[i].lookupNext = i + 1 < MAX_ENTRIES ? i + 1 : -1;
+        }
+        freeEntry = 0;
+        lruHead = lruTail = -1;
+        for (int i = 0; i < LOOKUP_BUCKETS; i++) lookupHead[i] = -1;
+        for (int i = 0; i < STATION_BUCKETS; i++) stationHead[i] = -1;
+        for (int i = 0; i < DEP_BUCKETS; i++) depHead[i] = -1;
+    }
+
+public:
+    QueryCache(long long budgetBytes = 4 << 20)
+        : depNodes(nullptr), depCapacity(0), depLive(0), freeDep(-1), bytesUsed(0), budget(budgetBytes), hits(0), misses(0) {
+        entries = new Entry[MAX_ENTRIES];
+        bytesUsed += (long long)MAX_ENTRIES * sizeof(Entry);
+        reset();
+    }
+
+    ~QueryCache() {
+        clear();
+        delete[] entries;
+        delete[] depNodes;
+    }
+
+    const CandidateTrain* findCandidates(const StationName& from, const StationName& to, int& count) {
+        int e = find(from, to, -1, false, false);
+        if (e == -1) return nullptr;
+        count = entries[e].candidateCount;
+        return entries[e].candidates;
+    }
+
+    void putCandidates(const StationName& from, const StationName& to, const CandidateTrain* list, int count) {
+        int bytes = count * sizeof(CandidateTrain);
+        if (!cacheable(bytes)) return;
+        int e = insert(from, to, -1, false, false, bytes);
+        entries[e].candidates = new CandidateTrain[count > 0 ? count : 1];
+        memcpy(entries[e].candidates, list, bytes);
+        entries[e].candidateCount = count;
+    }
+
+    const std::string* findResult(const StationName& from, const StationName& to, int day, bool byCost) {
+        int e = find(from, to, day, byCost, true);
+        return e == -1 ? nullptr : &entries[e].output;
+    }
+
+    // trainPos/startDays name the train runs whose seats the output shows
+    void putResult(const StationName& from, const StationName& to, int day, bool byCost,
+                   const std::string& output, const int* trainPos, const int* startDays, int count) {
+        int bytes = output.size() + count * (sizeof(int) + sizeof(DepNode));
+        if (!cacheable(bytes)) return;
+        int e = insert(from, to, day, byCost, true, bytes);
+        Entry& entry = entries[e];
+        entry.output = output;
+        entry.deps = new int[count > 0 ? count : 1];
+        entry.depCount = count;
+        for (int i = 0; i < count; i++) {
+            int d = allocDep();
+            DepNode& node = depNodes[d];
+            node.trainPos = trainPos[i];
+            node.startDay = startDays[i];
+            node.entry = e;
+            int b = depBucket(trainPos[i], startDays[i]);
+            node.prev = -1;
+            node.next = depHead[b];
+            if (depHead[b] != -1) depNodes[depHead[b]].prev = d;
+            depHead[b] = d;
+            entry.deps[i] = d;
+        }
+    }
+
+    // Drops every entry for a pair (stations[i], stations[j]) with i < j
+    void invalidateStations(const char (*stations)[31], int stationNum) {
+        for (int i = 0; i < stationNum - 1; i++) {
+            StationName from(stations[i]);
+            int e = stationHead[from.hash() % STATION_BUCKETS];
+            while (e != -1) {
+                int next = entries[e].stationNext;
+                if (entries[e].from == from) {
+                    for (int j = i + 1; j < stationNum; j++) {
+                        if (strcmp(entries[e].to.c_str(), stations[j]) == 0) {
+                            remove(e);
+                            break;
+                        }
+                    }
+                }
+                e = next;
+            }
+        }
+    }
+
+    // Drops every result showing seats of the train run starting on startDay
+    void invalidateSeats(int trainPos, int startDay) {
+        int b = depBucket(trainPos, startDay);
+        // remove() releases all of an entry's nodes, so rescan after each one
+        bool removed = true;
+        while (removed) {
+            removed = false;
+            for (int d = depHead[b]; d != -1; d = depNodes[d].next) {
+                if (depNodes[d].trainPos == trainPos && depNodes[d].startDay == startDay) {
+                    remove(depNodes[d].entry);
+                    removed = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    void clear() {
+        while (lruTail != -1) remove(lruTail);
+    }
+
+    // Evicts least recently used entries until the cache fits. Free
+    // dependency slots are not counted: evicting cannot reclaim them, and
+    // compactDeps() keeps them under three quarters of the array.
+    void setMemoryBudget(long long bytes) override {
+        budget = bytes;
+        while (lruTail != -1 && bytesUsed > budget) remove(lruTail);
+    }
+
+    long long memoryUsage() const override {
+        return bytesUsed + (long long)(depCapacity - depLive) * sizeof(DepNode);
+    }
+    long long hitCount() const override { return hits; }
+    long long missCount() const override { return misses; }
+};
+
+#endif
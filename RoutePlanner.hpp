@@ -0,0 +1,332 @@
+#ifndef ROUTEPLANNER_HPP
+#define ROUTEPLANNER_HPP
+
+#include <cstring>
+#include "core.hpp"
+#include "FixedString.hpp"
+#include "Calendar.hpp"
+#include "MemoryGovernor.hpp"
+
+// One train ridden from one stop to a later one
+struct RouteLeg {
+    TrainID trainID;
+    int fromStop, toStop;
+    TimePoint leaveTime, arriveTime;
+    int price;
+    int startDay;  // Run of the train the leg rides
+    int boardIdx, alightIdx;  // Station indices within the train
+};
+
+// Round-based timetable search (multi-criteria RAPTOR) over released trains.
+//
+// Every released train is a route whose trips are its daily runs within
+// the sale window. Routes are stored in flat arrays: per-stop stop ids,
+// arrival/departure offsets from the run's start and cumulative prices.
+// Each stop keeps a chain of (route, index) pairs serving it.
+//
+// Round k finds journeys of exactly k legs. Every stop holds a bag of
+// labels that are Pareto-optimal in (arrival, cost) across rounds <= k,
+// so the best journey by either criterion is exact for up to k legs.
+class RoutePlanner : public MemoryConsumer {
+private:
+    struct Route {
+        TrainID trainID;
+        int seatNum;
+        int startMinutes;
+        int saleStart, saleEnd;
+        int firstStop;  // Index into the flat stop arrays
+        int stopCount;
+    };
+
+    struct StopRoute {
+        int route;
+        int index;
+        int next;
+    };
+
+    struct Label {
+        int arrival;
+        int cost;
+        int parent;
+        int route;
+        int startDay;
+        int boardIdx, alightIdx;
+        int nextInBag;
+    };
+
+    // Candidate trip while scanning a route, boarded at boardIdx
+    struct RouteLabel {
+        int startDay;
+        int baseCost;  // Label cost minus the cumulative price at boarding
+        int parent;
+        int boardIdx;
+    };
+
+    static const int STATION_TABLE = 10007;
+
+    HashMap<StationName, int, STATION_TABLE>* stopIds;
+    Array<StationName> stopNames;
+    Array<int> stopRouteHead;
+    Array<StopRoute> stopRoutes;
+
+    Array<Route> routes;
+    Array<int> routeStops;
+    Array<int> arrOffsets;
+    Array<int> depOffsets;
+    Array<int> cumPrices;
+
+    // Per-query state
+    Array<Label> labels;
+
+    int stopOf(const StationName& name) {
+        int id;
+        if (stopIds->find(name, id)) return id;
+        id = stopNames.size();
+        stopIds->insert(name, id);
+        stopNames.add(name);
+        stopRouteHead.add(-1);
+        return id;
+    }
+
+    bool dominated(int bagHead, int arrival, int cost) const {
+        for (int l = bagHead; l != -1; l = labels[l].nextInBag) {
+            if (labels[l].arrival <= arrival && labels[l].cost <= cost) return true;
+        }
+        return false;
+    }
+
+    // Earliest run of route r leaving its stop i at or after time, or -1
+    int earliestTrip(const Route& r, int i, int time) const {
+        int offset = r.startMinutes + depOffsets[r.firstStop + i];
+        int day = time - offset <= 0 ? 0 : (time - offset + MINUTES_PER_DAY - 1) / MINUTES_PER_DAY;
+        if (day < r.saleStart) day = r.saleStart;
+        return day <= r.saleEnd ? day : -1;
+    }
+
+public:
+    RoutePlanner() {
+        stopIds = new HashMap<StationName, int, STATION_TABLE>();
+    }
+
+    ~RoutePlanner() {
+        delete stopIds;
+    }
+
+    // offsets are minutes after the run's departure from the first station
+    void addRoute(const TrainID& trainID, int seatNum, int startMinutes, int saleStart, int saleEnd,
+                  int stationNum, const char (*stations)[31], const int* arrive, const int* leave,
+                  const int* prices) {
+        Route r;
+        r.trainID = trainID;
+        r.seatNum = seatNum;
+        r.startMinutes = startMinutes;
+        r.saleStart = saleStart;
+        r.saleEnd = saleEnd;
+        r.firstStop = routeStops.size();
+        r.stopCount = stationNum;
+        int id = routes.size();
+        routes.add(r);
+
+        for (int i = 0; i < stationNum; i++) {
+            int stop = stopOf(StationName(stations[i]));
+            routeStops.add(stop);
+            arrOffsets.add(arrive[i]);
+            depOffsets.add(leave[i]);
+            cumPrices.add(prices[i]);
+
+            StopRoute sr;
+            sr.route = id;
+            sr.index = i;
+            sr.next = stopRouteHead[stop];
+            stopRouteHead[stop] = stopRoutes.size();
+            stopRoutes.add(sr);
+        }
+    }
+
+    // Best journey of at most maxLegs legs leaving from on day, or 0 legs
+    int plan(const StationName& from, const StationName& to, int day, int maxLegs, bool byCost,
+             RouteLeg* legs) {
+        int source, target;
+        if (!stopIds->find(from, source) || !stopIds->find(to, target) || source == target) return 0;
+
+        int stopCount = stopNames.size();
+        int rounds = maxLegs + 1;
+        int* bags = new int[rounds * stopCount];
+        for (int i = 0; i < rounds * stopCount; i++) bags[i] = -1;
+        bool* marked = new bool[stopCount]();
+        bool* nextMarked = new bool[stopCount]();
+        int* routeFrom = new int[routes.size() > 0 ? routes.size() : 1];
+        for (int i = 0; i < routes.size(); i++) routeFrom[i] = -1;
+        Array<int> queued;
+        Array<RouteLabel> routeBag;
+
+        labels.clear();
+        Label start;
+        start.arrival = day * MINUTES_PER_DAY;
+        start.cost = 0;
+        start.parent = -1;
+        start.route = -1;
+        start.nextInBag = -1;
+        labels.add(start);
+        bags[source] = 0;
+        marked[source] = true;
+
+        for (int k = 1; k < rounds; k++) {
+            queued.clear();
+            for (int p = 0; p < stopCount; p++) {
+                if (!marked[p]) continue;
+                for (int s = stopRouteHead[p]; s != -1; s = stopRoutes[s].next) {
+                    int r = stopRoutes[s].route;
+                    if (routeFrom[r] == -1) queued.add(r);
+                    if (routeFrom[r] == -1 || stopRoutes[s].index < routeFrom[r]) {
+                        routeFrom[r] = stopRoutes[s].index;
+                    }
+                }
+            }
+            for (int p = 0; p < stopCount; p++) nextMarked[p] = false;
+
+            for (int q = 0; q < queued.size(); q++) {
+                int r = queued[q];
+                const Route& route = routes[r];
+                routeBag.clear();
+
+                for (int i = routeFrom[r]; i < route.stopCount; i++) {
+                    int p = routeStops[route.firstStop + i];
+
+                    // Alight every candidate trip here
+                    for (int b = 0; b < routeBag.size(); b++) {
+                        const RouteLabel& rl = routeBag[b];
+                        int arrival = rl.startDay * MINUTES_PER_DAY + route.startMinutes + arrOffsets[route.firstStop + i];
+                        int cost = rl.baseCost + cumPrices[route.firstStop + i];
+                        bool dominatedSoFar = false;
+                        for (int j = 1; j <= k && !dominatedSoFar; j++) {
+                            dominatedSoFar = dominated(bags[j * stopCount + p], arrival, cost);
+                        }
+                        if (dominatedSoFar) continue;
+
+                        // Drop labels of this round that the new one dominates
+                        int* link = &bags[k * stopCount + p];
+                        while (*link != -1) {
+                            Label& old = labels[*link];
+                            if (arrival <= old.arrival && cost <= old.cost) *link = old.nextInBag;
+                            else link = &old.nextInBag;
+                        }
+                        Label label;
+                        label.arrival = arrival;
+                        label.cost = cost;
+                        label.parent = rl.parent;
+                        label.route = r;
+                        label.startDay = rl.startDay;
+                        label.boardIdx = rl.boardIdx;
+                        label.alightIdx = i;
+                        label.nextInBag = bags[k * stopCount + p];
+                        bags[k * stopCount + p] = labels.size();
+                        labels.add(label);
+                        nextMarked[p] = true;
+                    }
+
+                    // Board from labels that reached this stop last round
+                    if (i == route.stopCount - 1) break;
+                    for (int l = bags[(k - 1) * stopCount + p]; l != -1; l = labels[l].nextInBag) {
+                        if (labels[l].route == r) continue;
+                        int trip = earliestTrip(route, i, labels[l].arrival);
+                        if (trip == -1) continue;
+                        if (k == 1 && trip * MINUTES_PER_DAY + route.startMinutes + depOffsets[route.firstStop + i] >= (day + 1) * MINUTES_PER_DAY) {
+                            continue;
+                        }
+                        RouteLabel rl;
+                        rl.startDay = trip;
+                        rl.baseCost = labels[l].cost - cumPrices[route.firstStop + i];
+                        rl.parent = l;
+                        rl.boardIdx = i;
+
+                        bool keep = true;
+                        for (int b = 0; b < routeBag.size() && keep; b++) {
+                            keep = !(routeBag[b].startDay <= rl.startDay && routeBag[b].baseCost <= rl.baseCost);
+                        }
+                        if (!keep) continue;
+                        int kept = 0;
+                        for (int b = 0; b < routeBag.size(); b++) {
+                            if (!(rl.startDay <= routeBag[b].startDay && rl.baseCost <= routeBag[b].baseCost)) {
+                                routeBag[kept++] = routeBag[b];
+                            }
+                        }
+                        routeBag.truncate(kept);
+                        routeBag.add(rl);
+                    }
+                }
+                routeFrom[r] = -1;
+            }
+
+            bool* swap = marked;
+            marked = nextMarked;
+            nextMarked = swap;
+        }
+
+        // Best label at the target over all rounds; fewer legs break ties
+        int best = -1;
+        for (int k = 1; k < rounds; k++) {
+            for (int l = bags[k * stopCount + target]; l != -1; l = labels[l].nextInBag) {
+                if (best == -1) {
+                    best = l;
+                    continue;
+                }
+                const Label& a = labels[l];
+                const Label& b = labels[best];
+                bool better = byCost ? (a.cost < b.cost || (a.cost == b.cost && a.arrival < b.arrival))
+                                     : (a.arrival < b.arrival || (a.arrival == b.arrival && a.cost < b.cost));
+                if (better) best = l;
+            }
+        }
+
+        int count = 0;
+        for (int l = best; l != -1 && labels[l].parent != -1; l = labels[l].parent) count++;
+        int idx = count;
+        for (int l = best; l != -1 && labels[l].parent != -1; l = labels[l].parent) {
+            const Label& label = labels[l];
+            const Route& route = routes[label.route];
+            RouteLeg& leg = legs[--idx];
+            leg.trainID = route.trainID;
+            leg.fromStop = routeStops[route.firstStop + label.boardIdx];
+            leg.toStop = routeStops[route.firstStop + label.alightIdx];
+            int base = label.startDay * MINUTES_PER_DAY + route.startMinutes;
+            leg.leaveTime = base + depOffsets[route.firstStop + label.boardIdx];
+            leg.arriveTime = base + arrOffsets[route.firstStop + label.alightIdx];
+            leg.price = cumPrices[route.firstStop + label.alightIdx] - cumPrices[route.firstStop + label.boardIdx];
+            leg.startDay = label.startDay;
+            leg.boardIdx = label.boardIdx;
+            leg.alightIdx = label.alightIdx;
+        }
+
+        delete[] bags;
+        delete[] marked;
+        delete[] nextMarked;
+        delete[] routeFrom;
+        return count;
+    }
+
+    const StationName& stationName(int stop) const { return stopNames[stop]; }
+
+    long long memoryUsage() const override {
+        return (long long)sizeof(*stopIds) + (long long)stopNames.capacity() * sizeof(StationName) +
+               (long long)stopRouteHead.capacity() * sizeof(int) +
+               (long long)stopRoutes.capacity() * sizeof(StopRoute) +
+               (long long)routes.capacity() * sizeof(Route) + (long long)routeStops.capacity() * sizeof(int) +
+               (long long)(arrOffsets.capacity() + depOffsets.capacity()) * sizeof(int) +
+               (long long)cumPrices.capacity() * sizeof(int) + (long long)labels.capacity() * sizeof(Label);
+    }
+
+    void clear() {
+        stopIds->clear();
+        stopNames.clear();
+        stopRouteHead.clear();
+        stopRoutes.clear();
+        routes.clear();
+        routeStops.clear();
+        arrOffsets.clear();
+        depOffsets.clear();
+        cumPrices.clear();
+    }
+};
+
+#endif
@@ -0,0 +1,225 @@
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include <cstring>
+#include <csignal>
+#include <cerrno>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "TicketSystem.hpp"
+#include "CommandReader.hpp"
+
+// Serves the stdin command protocol to many clients over a Unix socket.
+//
+// One epoll loop owns every connection. Each wakeup first reads whatever the
+// ready clients sent, then runs all of their complete lines back to back on
+// the shared TicketSystem, then writes each client's replies with one send.
+// Commands run one at a time, so state and caches are shared exactly as if
+// all sessions were interleaved on one stdin. "exit" ends only the session
+// that sent it; SIGINT or SIGTERM flushes the database and stops the server.
+class Server {
+private:
+    static const int MAX_CLIENTS = 1024;
+    static const int MAX_EVENTS = 64;
+    static const int READ_CHUNK = 1 << 16;
+
+    struct Client {
+        int fd;
+        std::string input;   // Bytes not yet forming a full line
+        std::string output;  // Replies not yet sent
+        bool closing;        // Close once output is sent
+    };
+
+    TicketSystem& system;
+    std::string path;
+    int listenFd;
+    int epollFd;
+    Client* clients[MAX_CLIENTS];  // Indexed by fd
+    char* chunk;
+
+    static volatile sig_atomic_t& stopRequested() {
+        static volatile sig_atomic_t flag = 0;
+        return flag;
+    }
+
+    static void onSignal(int) { stopRequested() = 1; }
+
+    static void setNonBlocking(int fd) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    }
+
+    void watch(int fd, unsigned int events, int op) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = events;
+        ev.data.fd = fd;
+        epoll_ctl(epollFd, op, fd, &ev);
+    }
+
+    void acceptClients() {
+        while (true) {
+            int fd = accept(listenFd, nullptr, nullptr);
+            if (fd == -1) return;
+            if (fd >= MAX_CLIENTS) {
+                close(fd);
+                continue;
+            }
+            setNonBlocking(fd);
+            Client* client = new Client();
+            client->fd = fd;
+            client->closing = false;
+            clients[fd] = client;
+            watch(fd, EPOLLIN, EPOLL_CTL_ADD);
+        }
+    }
+
+    void closeClient(Client* client) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, client->fd, nullptr);
+        close(client->fd);
+        clients[client->fd] = nullptr;
+        delete client;
+    }
+
+    // Drains the socket; end of input finishes the session after its replies
+    void readClient(Client* client) {
+        while (true) {
+            ssize_t n = read(client->fd, chunk, READ_CHUNK);
+            if (n > 0) {
+                client->input.append(chunk, n);
+                continue;
+            }
+            if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                // A last line without a newline still counts, as on stdin
+                if (!client->input.empty()) client->input += '\n';
+                client->closing = true;
+            }
+            return;
+        }
+    }
+
+    void runCommands(Client* client, Command& command, std::ostringstream& captured) {
+        size_t start = 0;
+        while (true) {
+            size_t nl = client->input.find('\n', start);
+            if (nl == std::string::npos) break;
+            tokenizeCommand(client->input.data() + start, nl - start, command);
+            start = nl + 1;
+            if (command.name.empty()) continue;
+            if (command.name == "exit") {
+                client->output += "bye\n";
+                client->closing = true;
+                start = client->input.size();
+                break;
+            }
+            system.processCommand(command);
+            client->output += captured.str();
+            captured.str("");
+        }
+        client->input.erase(0, start);
+    }
+
+    // Sends what the socket takes; returns false once the client is gone
+    bool writeClient(Client* client) {
+        size_t sent = 0;
+        while (sent < client->output.size()) {
+            ssize_t n = send(client->fd, client->output.data() + sent, client->output.size() - sent, MSG_NOSIGNAL);
+            if (n > 0) {
+                sent += n;
+                continue;
+            }
+            if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            if (n == -1 && errno == EINTR) continue;
+            closeClient(client);
+            return false;
+        }
+        client->output.erase(0, sent);
+        if (client->output.empty() && client->closing) {
+            closeClient(client);
+            return false;
+        }
+        watch(client->fd, client->output.empty() ? EPOLLIN : EPOLLIN | EPOLLOUT, EPOLL_CTL_MOD);
+        return true;
+    }
+
+public:
+    Server(TicketSystem& ticketSystem, const std::string& socketPath)
+        : system(ticketSystem), path(socketPath), listenFd(-1), epollFd(-1) {
+        for (int i = 0; i < MAX_CLIENTS; i++) clients[i] = nullptr;
+        chunk = new char[READ_CHUNK];
+    }
+
+    ~Server() {
+        for (int i = 0; i < MAX_CLIENTS; i++) {
+            if (clients[i]) closeClient(clients[i]);
+        }
+        if (listenFd != -1) {
+            close(listenFd);
+            unlink(path.c_str());
+        }
+        if (epollFd != -1) close(epollFd);
+        delete[] chunk;
+    }
+
+    // Runs until SIGINT or SIGTERM; returns false if the socket cannot be set up
+    bool run() {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) return false;
+        strcpy(addr.sun_path, path.c_str());
+
+        listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listenFd == -1) return false;
+        unlink(path.c_str());
+        if (bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(listenFd, 128) == -1) {
+            return false;
+        }
+        setNonBlocking(listenFd);
+        epollFd = epoll_create1(0);
+        watch(listenFd, EPOLLIN, EPOLL_CTL_ADD);
+
+        signal(SIGINT, onSignal);
+        signal(SIGTERM, onSignal);
+
+        // Command output goes to std::cout; collect it per command instead
+        std::ostringstream captured;
+        std::streambuf* original = std::cout.rdbuf(captured.rdbuf());
+        Command command;
+        struct epoll_event events[MAX_EVENTS];
+        Client* ready[MAX_EVENTS];
+
+        while (!stopRequested()) {
+            int n = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+            if (n == -1) continue;  // EINTR from a signal
+
+            int readyCount = 0;
+            for (int i = 0; i < n; i++) {
+                int fd = events[i].data.fd;
+                if (fd == listenFd) {
+                    acceptClients();
+                    continue;
+                }
+                Client* client = clients[fd];
+                if (!client) continue;
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) readClient(client);
+                ready[readyCount++] = client;
+            }
+
+            // Run the whole batch, then answer every client once
+            for (int i = 0; i < readyCount; i++) runCommands(ready[i], command, captured);
+            for (int i = 0; i < readyCount; i++) writeClient(ready[i]);
+        }
+
+        std::cout.rdbuf(original);
+        system.flush();
+        return true;
+    }
+};
+
+#endif
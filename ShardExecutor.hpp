@@ -0,0 +1,202 @@
+#ifndef SHARDEXECUTOR_HPP
+#define SHARDEXECUTOR_HPP
+
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <utility>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "TicketSystem.hpp"
+#include "CommandReader.hpp"
+
+// Runs commands on shard threads partitioned by train.
+//
+// buy_ticket, query_train and refund_ticket touch exactly one train. Each
+// goes to the shard that owns its trainID hash through that shard's
+// single-producer/single-consumer queue, so different trains run in
+// parallel while commands on one train keep their input order. Commands of
+// one user also keep their order: if the user's last command went to
+// another shard, dispatch waits until that shard has finished it. Every
+// other command runs on the dispatching thread once all shards have
+// drained; cross-train queries such as query_ticket then fan out over the
+// system's worker pool. Replies are buffered per command and printed in
+// input order, so the output matches a sequential run.
+class ShardExecutor {
+public:
+    static const int MAX_SHARDS = 64;
+
+private:
+    static const int IN_FLIGHT = 512;  // Power of two
+
+    struct Entry {
+        Command command;
+        std::string reply;
+        std::atomic<bool> done;
+    };
+
+    struct Shard {
+        std::thread thread;
+        long long queue[IN_FLIGHT];  // Sequence numbers; never more than IN_FLIGHT in flight
+        std::atomic<long long> head;  // Next to run
+        std::atomic<long long> tail;  // Next free
+        std::atomic<long long> finished;  // Last sequence number run, -1 if none
+        long long lastQueued;  // Dispatcher only
+    };
+
+    TicketSystem& system;
+    int shardCount;
+    Shard* shards;
+    Entry* entries;
+    std::atomic<bool> stopping;
+
+    // Per user: shard and sequence number of the last command sent to a shard
+    int userShard[MAX_USERS];
+    long long userSeq[MAX_USERS];
+
+    // Every thread sleeps here once spinning has not paid off
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::atomic<int> sleepers;
+
+    template<typename Ready>
+    void waitUntil(Ready ready) {
+        for (int spins = 0; spins < 256; spins++) {
+            if (ready()) return;
+            if (spins >= 64) std::this_thread::yield();
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        sleepers++;
+        changed.wait(lock, ready);
+        sleepers--;
+    }
+
+    void wakeOthers() {
+        if (sleepers.load() == 0) return;
+        std::lock_guard<std::mutex> lock(mutex);
+        changed.notify_all();
+    }
+
+    void shardLoop(int s) {
+        Shard& shard = shards[s];
+        std::ostringstream replies;
+        TicketSystem::setReplyStream(&replies);
+        while (true) {
+            long long h = shard.head.load(std::memory_order_relaxed);
+            waitUntil([&] { return h != shard.tail.load() || stopping.load(); });
+            if (h == shard.tail.load()) return;
+            long long seq = shard.queue[h % IN_FLIGHT];
+            Entry& entry = entries[seq % IN_FLIGHT];
+            system.processCommand(entry.command);
+            entry.reply = replies.str();
+            replies.str("");
+            entry.done.store(true);
+            shard.finished.store(seq);
+            shard.head.store(h + 1);
+            wakeOthers();
+        }
+    }
+
+    bool drained() const {
+        for (int s = 0; s < shardCount; s++) {
+            if (shards[s].finished.load() != shards[s].lastQueued) return false;
+        }
+        return true;
+    }
+
+public:
+    ShardExecutor(TicketSystem& ticketSystem, int shardTotal)
+        : system(ticketSystem), stopping(false), sleepers(0) {
+        shardCount = shardTotal < 1 ? 1 : shardTotal > MAX_SHARDS ? MAX_SHARDS : shardTotal;
+        shards = new Shard[shardCount];
+        entries = new Entry[IN_FLIGHT];
+        for (int i = 0; i < IN_FLIGHT; i++) entries[i].done.store(true);
+        for (int u = 0; u < MAX_USERS; u++) userShard[u] = -1;
+        for (int s = 0; s < shardCount; s++) {
+            shards[s].head.store(0);
+            shards[s].tail.store(0);
+            shards[s].finished.store(-1);
+            shards[s].lastQueued = -1;
+            shards[s].thread = std::thread(&ShardExecutor::shardLoop, this, s);
+        }
+    }
+
+    ~ShardExecutor() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping.store(true);
+        }
+        changed.notify_all();
+        for (int s = 0; s < shardCount; s++) shards[s].thread.join();
+        delete[] shards;
+        delete[] entries;
+    }
+
+    long long memoryUsage() const {
+        return sizeof(ShardExecutor) + (long long)shardCount * sizeof(Shard) + (long long)IN_FLIGHT * sizeof(Entry);
+    }
+
+    // Runs every command from reader; returns at end of input
+    void run(CommandReader& reader) {
+        long long seq = 0;
+        long long printed = 0;
+        auto printReady = [&](bool wait) {
+            while (printed < seq) {
+                Entry& entry = entries[printed % IN_FLIGHT];
+                if (wait) waitUntil([&] { return entry.done.load(); });
+                else if (!entry.done.load()) break;
+                std::cout << entry.reply;
+                printed++;
+            }
+        };
+
+        while (Command* command = reader.next()) {
+            if (seq - printed == IN_FLIGHT) {
+                Entry& oldest = entries[printed % IN_FLIGHT];
+                waitUntil([&] { return oldest.done.load(); });
+                printReady(false);
+            }
+            Entry& entry = entries[seq % IN_FLIGHT];
+            std::swap(entry.command, *command);
+            reader.release();
+
+            int userPos = system.commandUser(entry.command);
+            if (userPos != -1 && userShard[userPos] != -1) {
+                Shard& previous = shards[userShard[userPos]];
+                long long last = userSeq[userPos];
+                waitUntil([&] { return previous.finished.load() >= last; });
+            }
+
+            int s = system.commandShard(entry.command, shardCount);
+            if (s == -1) {
+                // Runs alone, after everything before it
+                waitUntil([&] { return drained(); });
+                printReady(true);
+                system.processCommand(entry.command);
+                seq++;
+                printed = seq;
+                continue;
+            }
+
+            entry.done.store(false);
+            entry.reply.clear();
+            Shard& shard = shards[s];
+            long long t = shard.tail.load(std::memory_order_relaxed);
+            shard.queue[t % IN_FLIGHT] = seq;
+            shard.lastQueued = seq;
+            shard.tail.store(t + 1);
+            if (userPos != -1) {
+                userShard[userPos] = s;
+                userSeq[userPos] = seq;
+            }
+            wakeOthers();
+            seq++;
+            printReady(false);
+        }
+        printReady(true);
+    }
+};
+
+#endif
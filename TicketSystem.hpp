@@ -4,8 +4,22 @@
 #include <iostream>
 #include <string>
 #include <cstring>
+#include <cstddef>
 #include <fstream>
 #include <sstream>
+#include <atomic>
+#include "FixedString.hpp"
+#include "Calendar.hpp"
+#include "Pager.hpp"
+#include "BloomFilter.hpp"
+#include "QueryCache.hpp"
+#include "RoutePlanner.hpp"
+#include "WorkerPool.hpp"
+#include "CommandReader.hpp"
+#include "MemoryGovernor.hpp"
+#include "VersionStore.hpp"
+#include "ExtendibleHash.hpp"
+#include "HeapFile.hpp"
 
 // Simple vector implementation
 template<typename T>
@@ -57,92 +71,57 @@ public:
     T* end() { return data + length; }
 };
 
-// Simple file-based storage
+// Fixed-size record storage on a pager segment
 template<typename T>
 class FileStorage {
 private:
-    std::string filename;
-    std::fstream file;
+    Segment segment;
     
 public:
-    FileStorage(const std::string& fname) : filename(fname) {}
+    FileStorage(Pager& pager, const char* name) : segment(pager, name) {}
     
     void write(int pos, const T& data) {
-        file.open(filename, std::ios::in | std::ios::out | std::ios::binary);
-        if (!file.is_open()) {
-            file.clear();
-            file.open(filename, std::ios::out | std::ios::binary);
-            file.close();
-            file.open(filename, std::ios::in | std::ios::out | std::ios::binary);
-        }
-        file.seekp(pos * sizeof(T));
-        file.write(reinterpret_cast<const char*>(&data), sizeof(T));
-        file.close();
+        segment.write((long long)pos * sizeof(T), &data, sizeof(T));
     }
     
     bool read(int pos, T& data) {
-        file.open(filename, std::ios::in | std::ios::binary);
-        if (!file.is_open()) return false;
-        file.seekg(pos * sizeof(T));
-        file.read(reinterpret_cast<char*>(&data), sizeof(T));
-        bool success = file.gcount() == sizeof(T);
-        file.close();
-        return success;
+        long long offset = (long long)pos * sizeof(T);
+        if (offset + (long long)sizeof(T) > segment.size()) return false;
+        segment.read(offset, &data, sizeof(T));
+        return true;
     }
     
-    void clear() {
-        std::remove(filename.c_str());
-    }
-};
-
-// Simple date/time utilities
-struct DateTime {
-    int month, day, hour, minute;
-    
-    DateTime() : month(0), day(0), hour(0), minute(0) {}
-    
-    DateTime(int m, int d, int h, int min) : month(m), day(d), hour(h), minute(min) {}
-    
-    int toMinutes() const {
-        int days = 0;
-        if (month == 6) days = day - 1;
-        else if (month == 7) days = 30 + day - 1;
-        else if (month == 8) days = 61 + day - 1;
-        return days * 24 * 60 + hour * 60 + minute;
-    }
-    
-    static DateTime fromMinutes(int minutes) {
-        int days = minutes / (24 * 60);
-        int remaining = minutes % (24 * 60);
-        int hour = remaining / 60;
-        int minute = remaining % 60;
-        
-        int month, day;
-        if (days < 30) {
-            month = 6;
-            day = days + 1;
-        } else if (days < 61) {
-            month = 7;
-            day = days - 30 + 1;
-        } else {
-            month = 8;
-            day = days - 61 + 1;
+    // Records at positions[0..count) into out, fetched in file order;
+    // positions past the end read back as zeros
+    void readMany(const int* positions, int count, T* out) {
+        long long* offsets = new long long[count > 0 ? count : 1];
+        int* lengths = new int[count > 0 ? count : 1];
+        for (int i = 0; i < count; i++) {
+            offsets[i] = (long long)positions[i] * sizeof(T);
+            lengths[i] = sizeof(T);
         }
-        
-        return DateTime(month, day, hour, minute);
+        segment.readBatch(offsets, lengths, count, out);
+        delete[] offsets;
+        delete[] lengths;
     }
     
-    std::string toString() const {
-        if (month == 0) return "xx-xx xx:xx";
-        char buf[20];
-        sprintf(buf, "%02d-%02d %02d:%02d", month, day, hour, minute);
-        return std::string(buf);
+    // Single field of record pos, so concurrent writers of other fields do not collide
+    void readField(int pos, int fieldOffset, void* buf, int len) {
+        segment.read((long long)pos * sizeof(T) + fieldOffset, buf, len);
+    }
+    
+    void writeField(int pos, int fieldOffset, const void* buf, int len) {
+        segment.write((long long)pos * sizeof(T) + fieldOffset, buf, len);
+    }
+    
+    void clear() {
+        segment.clear();
     }
 };
 
 // User structure
 struct User {
-    char username[21];
+    UserName username;
     char password[31];
     char name[31];
     char mailAddr[31];
@@ -150,7 +129,6 @@ struct User {
     bool exists;
     
     User() {
-        memset(username, 0, sizeof(username));
         memset(password, 0, sizeof(password));
         memset(name, 0, sizeof(name));
         memset(mailAddr, 0, sizeof(mailAddr));
@@ -161,21 +139,21 @@ struct User {
 
 // Train structure
 struct Train {
-    char trainID[21];
+    TrainID trainID;
     int stationNum;
     int seatNum;
     char stations[100][31];
     int prices[100];
-    int startHour, startMinute;
+    int startTime;  // Minutes after midnight
     int travelTimes[100];
     int stopoverTimes[100];
     int saleStart, saleEnd;
     char type;
     bool released;
     bool exists;
+    long long seatOffset;  // Seat blocks in the seats segment, once released
     
     Train() {
-        memset(trainID, 0, sizeof(trainID));
         stationNum = 0;
         seatNum = 0;
         for (int i = 0; i < 100; i++) {
@@ -184,11 +162,70 @@ struct Train {
             travelTimes[i] = 0;
             stopoverTimes[i] = 0;
         }
-        startHour = startMinute = 0;
+        startTime = 0;
         saleStart = saleEnd = 0;
         type = 0;
         released = false;
         exists = false;
+        seatOffset = -1;
+    }
+    
+    // Variable-length encoding of everything but trainID and the status
+    // flags, which live in the fixed-size TrainRecord. Per-segment prices,
+    // travel and stopover times are the deltas of the cumulative values and
+    // are stored as varints; station names are length-prefixed.
+    static const int MAX_ENCODED = 8192;
+    
+    int encode(unsigned char* buf) const {
+        int n = 0;
+        n += writeVarint(buf + n, seatNum);
+        n += writeVarint(buf + n, startTime);
+        n += writeVarint(buf + n, saleStart);
+        n += writeVarint(buf + n, saleEnd);
+        buf[n++] = (unsigned char)type;
+        n += writeVarint(buf + n, stationNum);
+        for (int i = 0; i < stationNum; i++) {
+            int len = strlen(stations[i]);
+            buf[n++] = (unsigned char)len;
+            memcpy(buf + n, stations[i], len);
+            n += len;
+        }
+        for (int i = 0; i < stationNum - 1; i++) {
+            n += writeVarint(buf + n, prices[i]);
+        }
+        for (int i = 0; i < stationNum - 1; i++) {
+            n += writeVarint(buf + n, travelTimes[i]);
+        }
+        for (int i = 0; i < stationNum - 2; i++) {
+            n += writeVarint(buf + n, stopoverTimes[i]);
+        }
+        return n;
+    }
+    
+    void decode(const unsigned char* buf) {
+        unsigned int v;
+        int n = 0;
+        n += readVarint(buf + n, v); seatNum = v;
+        n += readVarint(buf + n, v); startTime = v;
+        n += readVarint(buf + n, v); saleStart = v;
+        n += readVarint(buf + n, v); saleEnd = v;
+        type = (char)buf[n++];
+        n += readVarint(buf + n, v); stationNum = v;
+        for (int i = 0; i < stationNum; i++) {
+            int len = buf[n++];
+            memcpy(stations[i], buf + n, len);
+            stations[i][len] = '\0';
+            n += len;
+        }
+        for (int i = 0; i < stationNum - 1; i++) {
+            n += readVarint(buf + n, v); prices[i] = v;
+        }
+        for (int i = 0; i < stationNum - 1; i++) {
+            n += readVarint(buf + n, v); travelTimes[i] = v;
+        }
+        for (int i = 0; i < stationNum - 2; i++) {
+            n += readVarint(buf + n, v); stopoverTimes[i] = v;
+        }
     }
     
     int getCumulativePrice(int from, int to) const {
@@ -199,19 +236,19 @@ struct Train {
         return sum;
     }
     
-    DateTime getArriveTime(int station, int startDay) const {
-        int minutes = startDay * 24 * 60 + startHour * 60 + startMinute;
+    TimePoint getArriveTime(int station, int startDay) const {
+        TimePoint minutes = startDay * MINUTES_PER_DAY + startTime;
         for (int i = 0; i < station; i++) {
             minutes += travelTimes[i];
             if (i > 0 && i < station) {
                 minutes += stopoverTimes[i - 1];
             }
         }
-        return DateTime::fromMinutes(minutes);
+        return minutes;
     }
     
-    DateTime getLeaveTime(int station, int startDay) const {
-        int minutes = startDay * 24 * 60 + startHour * 60 + startMinute;
+    TimePoint getLeaveTime(int station, int startDay) const {
+        TimePoint minutes = startDay * MINUTES_PER_DAY + startTime;
         for (int i = 0; i < station; i++) {
             minutes += travelTimes[i];
             if (i > 0) {
@@ -221,37 +258,135 @@ struct Train {
         if (station > 0) {
             minutes += stopoverTimes[station - 1];
         }
-        return DateTime::fromMinutes(minutes);
+        return minutes;
     }
 };
 
+// Fixed-size train slot; the encoded train and its timetable are records in trainHeap
+struct TrainRecord {
+    TrainID trainID;
+    bool released;
+    bool exists;
+    int dataLength;
+    long long dataRid;
+    long long seatOffset;
+    int timetableLength;  // 0 until released
+    long long timetableRid;
+    
+    TrainRecord()
+        : released(false), exists(false), dataLength(0), dataRid(-1), seatOffset(-1),
+          timetableLength(0), timetableRid(-1) {}
+};
+
+// query_train output of one train, rendered once at release. Station lines
+// are kept up to their seat column with the dates of start day 0; a query
+// copies each line, rewrites its "mm-dd" fields and appends the seats.
+struct TimetableHeader {
+    int stationNum;
+    int seatNum;
+    int saleStart, saleEnd;
+    int titleLength;
+};
+
+struct TimetableLine {
+    short length;
+    short arriveDate, leaveDate;  // Offsets of the "mm-dd" fields, -1 for none
+    short arriveDays, leaveDays;  // Days after the start day
+};
+
+// Header, 100 lines and their text, or the full rendered output
+const int MAX_TIMETABLE = 8192;
+
+const char ORDER_SUCCESS = 0;
+const char ORDER_PENDING = 1;
+const char ORDER_REFUNDED = 2;
+
+// One buy_ticket order. Orders of a user are chained newest first through
+// userPrev; pending orders of one train run are queued through queueNext.
+// After creation only status and queueNext change, and they are written
+// field by field so concurrent updates of other fields are never lost.
+struct Order {
+    TrainID trainID;
+    StationName from, to;
+    int trainPos;
+    int startDay;
+    int fromIdx, toIdx;
+    TimePoint leaveTime, arriveTime;
+    int price;  // Per ticket
+    int num;
+    int userPrev;
+    int queueNext;
+    char status;
+};
+
+// Total for all tracked memory; leaves headroom under the 42 MiB limit for
+// the stack, strings and allocator overhead
+const long long MEMORY_LIMIT = 32 * MEBIBYTE;
+const int REBALANCE_INTERVAL = 1024;  // Commands between cache rebalances
+const int USER_LOCK_STRIPES = 256;
+const int RUN_LOCK_STRIPES = 1024;  // Locks for (train, start day) seat blocks
+
+// Counters and train lists that must survive a restart. The whole record
+// lives at the start of the "catalog" segment and is loaded with one read.
+struct Catalog {
+    static const int MAGIC = 0x43544c49;
+    
+    int magic;
+    int userCount;  // Also the next user slot
+    int trainCount;
+    int releasedCount;
+    int trainSlots;  // Train slots handed out, deleted trains included
+    int freeSlotCount;
+    int orderCount;
+    int trainPositions[MAX_TRAINS];  // Slots of existing trains, in add order
+    int releasedPositions[MAX_TRAINS];  // Slots of released trains, in release order
+    int freeSlots[MAX_TRAINS];  // Slots of deleted trains, reused before trainSlots grows
+};
+
 class TicketSystem {
 private:
+    Pager pager;
     FileStorage<User> users;
-    FileStorage<Train> trains;
-    bool loggedIn[10000];
-    int userCount;
-    int trainCount;
-    int trainPositions[5000];  // Store positions of existing trains
-    
-    void parseCommand(const std::string& cmd, char keys[20], std::string values[20], int& count) {
-        std::istringstream iss(cmd);
-        std::string token;
-        count = 0;
-        
-        while (iss >> token) {
-            if (token[0] == '-' && token.length() == 2) {
-                char key = token[1];
-                std::string value;
-                if (iss >> value) {
-                    keys[count] = key;
-                    values[count] = value;
-                    count++;
-                }
-            }
-        }
+    FileStorage<TrainRecord> trains;
+    HeapFile trainHeap;  // Encoded trains and rendered timetables
+    BloomFilter<> userFilter;
+    BloomFilter<> trainFilter;
+    ExtendibleHash<UserName> userIndex;  // Username -> user slot
+    ExtendibleHash<TrainID> trainIndex;  // TrainID -> train slot of an existing train
+    QueryCache queryCache;
+    RoutePlanner planner;
+    WorkerPool workers;
+    Segment catalogSegment;
+    Segment seats;
+    FileStorage<Order> orders;
+    Segment userOrders;  // Newest order id + 1 of each user slot, 0 if none
+    VersionStore versions;  // Old seat blocks, orders and order heads for snapshot reads
+    bool loggedIn[MAX_USERS];
+    Catalog catalog;
+    bool routesLoaded;  // Planner holds every released train
+    MemoryGovernor memory;
+    std::atomic<int> commandsSinceRebalance;
+    bool memoryReport;
+    
+    // buy_ticket, refund_ticket, query_order, query_ticket and query_train
+    // may run on several threads at once; other commands must run alone.
+    // Booking locks are always taken in this order: user stripe, then run
+    // stripe, then orderMutex or cacheMutex. No path holds two of a kind.
+    // Queries take none of them: they read through a VersionStore snapshot.
+    std::mutex userLocks[USER_LOCK_STRIPES];
+    std::mutex runLocks[RUN_LOCK_STRIPES];
+    std::mutex orderMutex;
+    std::mutex cacheMutex;  // queryCache and seatEpoch
+    long long seatEpoch;  // Bumped on every seat change
+    
+    // Replies go to std::cout unless this thread pointed them elsewhere
+    static std::ostream*& replyTarget() {
+        thread_local std::ostream* target = &std::cout;
+        return target;
     }
     
+    static std::ostream& reply() { return *replyTarget(); }
+    
     std::string getParam(char key, char keys[20], std::string values[20], int count) {
         for (int i = 0; i < count; i++) {
             if (keys[i] == key) {
@@ -280,106 +415,458 @@ private:
         return result;
     }
     
-    int dateToDay(const std::string& date) {
-        int month = (date[0] - '0') * 10 + (date[1] - '0');
-        int day = (date[3] - '0') * 10 + (date[4] - '0');
-        
-        if (month == 6) return day - 1;
-        if (month == 7) return 30 + day - 1;
-        return 61 + day - 1;
+    int findUser(const UserName& username) {
+        if (!userFilter.mightContain(username)) return -1;
+        int pos;
+        return userIndex.find(username, pos) ? pos : -1;
+    }
+    
+    // Next user slot, or -1 once MAX_USERS are registered
+    int createUser(const UserName& username) {
+        int pos = catalog.userCount;
+        if (pos >= MAX_USERS || !userIndex.insert(username, pos)) return -1;
+        userFilter.add(username);
+        return pos;
+    }
+    
+    int findTrain(const TrainID& trainID) {
+        if (!trainFilter.mightContain(trainID)) return -1;
+        int pos;
+        return trainIndex.find(trainID, pos) ? pos : -1;
+    }
+    
+    static void decodeTrain(const TrainRecord& record, const unsigned char* data, Train& train) {
+        train.trainID = record.trainID;
+        train.released = record.released;
+        train.exists = record.exists;
+        train.seatOffset = record.seatOffset;
+        if (data) train.decode(data);
     }
     
-    int hashString(const std::string& str) {
-        unsigned int h = 0;
-        for (char c : str) {
-            h = h * 131 + c;
+    bool loadTrain(int pos, Train& train) {
+        TrainRecord record;
+        if (!trains.read(pos, record)) return false;
+        if (record.exists) {
+            unsigned char buf[Train::MAX_ENCODED];
+            trainHeap.read(record.dataRid, buf);
+            decodeTrain(record, buf, train);
+        } else {
+            decodeTrain(record, nullptr, train);
         }
-        return h % 10000;
+        return true;
     }
     
-    int findUser(const std::string& username) {
-        int hash = hashString(username);
-        for (int i = 0; i < 100; i++) {
-            int pos = (hash + i) % 10000;
-            User user;
-            if (users.read(pos, user)) {
-                if (user.exists && strcmp(user.username, username.c_str()) == 0) {
-                    return pos;
-                }
-                if (!user.exists) {
-                    return -1;
-                }
-            } else {
-                return -1;
-            }
+    // Records of the trains at positions, then the encoded data of the
+    // released ones, each set fetched with one batched read. dataAt[i] is
+    // where train i's data starts in the returned buffer, or -1 if train i
+    // is not released. The caller deletes the buffer.
+    unsigned char* readReleasedTrains(const int* positions, int count, TrainRecord* records, long long* dataAt) {
+        trains.readMany(positions, count, records);
+        long long* rids = new long long[count > 0 ? count : 1];
+        int* lengths = new int[count > 0 ? count : 1];
+        int wanted = 0;
+        long long total = 0;
+        for (int i = 0; i < count; i++) {
+            dataAt[i] = -1;
+            if (!records[i].exists || !records[i].released) continue;
+            dataAt[i] = total;
+            rids[wanted] = records[i].dataRid;
+            lengths[wanted++] = records[i].dataLength;
+            total += records[i].dataLength;
         }
-        return -1;
+        unsigned char* data = new unsigned char[total > 0 ? total : 1];
+        trainHeap.readMany(rids, lengths, wanted, data);
+        delete[] rids;
+        delete[] lengths;
+        return data;
     }
     
-    int findOrCreateUser(const std::string& username) {
-        int hash = hashString(username);
-        for (int i = 0; i < 100; i++) {
-            int pos = (hash + i) % 10000;
-            User user;
-            if (!users.read(pos, user) || !user.exists) {
-                return pos;
+    void storeTrain(int pos, const Train& train) {
+        unsigned char buf[Train::MAX_ENCODED];
+        TrainRecord record;
+        record.trainID = train.trainID;
+        record.released = train.released;
+        record.exists = train.exists;
+        record.dataLength = train.encode(buf);
+        record.dataRid = trainHeap.insert(buf, record.dataLength);
+        record.seatOffset = train.seatOffset;
+        trains.write(pos, record);
+        trainFilter.add(train.trainID);
+    }
+    
+    // Lays out header, lines and text as described at TimetableHeader; returns the length
+    static int renderTimetable(const Train& train, char* blob) {
+        TimetableHeader header;
+        TimetableLine lines[100];
+        header.stationNum = train.stationNum;
+        header.seatNum = train.seatNum;
+        header.saleStart = train.saleStart;
+        header.saleEnd = train.saleEnd;
+        
+        char* textStart = blob + sizeof(TimetableHeader) + train.stationNum * sizeof(TimetableLine);
+        char* out = formatText(textStart, train.trainID.c_str());
+        *out++ = ' ';
+        *out++ = train.type;
+        *out++ = '\n';
+        header.titleLength = out - textStart;
+        
+        for (int i = 0; i < train.stationNum; i++) {
+            bool last = i == train.stationNum - 1;
+            char* line = out;
+            TimetableLine& slots = lines[i];
+            slots.arriveDate = slots.leaveDate = -1;
+            slots.arriveDays = slots.leaveDays = 0;
+            out = formatText(out, train.stations[i]);
+            *out++ = ' ';
+            if (i == 0) {
+                out = formatNoTime(out);
+            } else {
+                TimePoint arrive = train.getArriveTime(i, 0);
+                slots.arriveDate = out - line;
+                slots.arriveDays = arrive / MINUTES_PER_DAY;
+                out = formatTime(out, arrive);
             }
-            if (strcmp(user.username, username.c_str()) == 0) {
-                return pos;
+            out = formatText(out, " -> ");
+            if (last) {
+                out = formatNoTime(out);
+            } else {
+                TimePoint leave = train.getLeaveTime(i, 0);
+                slots.leaveDate = out - line;
+                slots.leaveDays = leave / MINUTES_PER_DAY;
+                out = formatTime(out, leave);
             }
+            *out++ = ' ';
+            out = formatInt(out, train.getCumulativePrice(0, i));
+            *out++ = ' ';
+            slots.length = out - line;
         }
-        return -1;
+        
+        memcpy(blob, &header, sizeof(header));
+        memcpy(blob + sizeof(header), lines, train.stationNum * sizeof(TimetableLine));
+        return out - blob;
     }
     
-    int findTrain(const std::string& trainID) {
-        int hash = hashString(trainID);
-        for (int i = 0; i < 100; i++) {
-            int pos = (hash + i) % 10000;
-            Train train;
-            if (trains.read(pos, train)) {
-                if (train.exists && strcmp(train.trainID, trainID.c_str()) == 0) {
-                    return pos;
-                }
-                if (!train.exists) {
-                    return -1;
-                }
-            } else {
-                return -1;
-            }
+    // Registers a released train with the route planner
+    void addRoute(const Train& train) {
+        int arrive[100], leave[100], cumPrice[100];
+        int minutes = 0;
+        arrive[0] = leave[0] = cumPrice[0] = 0;
+        for (int i = 1; i < train.stationNum; i++) {
+            minutes += train.travelTimes[i - 1];
+            arrive[i] = minutes;
+            if (i < train.stationNum - 1) minutes += train.stopoverTimes[i - 1];
+            leave[i] = minutes;
+            cumPrice[i] = cumPrice[i - 1] + train.prices[i - 1];
         }
-        return -1;
+        planner.addRoute(train.trainID, train.seatNum, train.startTime,
+                         train.saleStart, train.saleEnd, train.stationNum, train.stations,
+                         arrive, leave, cumPrice);
     }
     
-    int findOrCreateTrain(const std::string& trainID) {
-        int hash = hashString(trainID);
-        for (int i = 0; i < 100; i++) {
-            int pos = (hash + i) % 10000;
+    // Writes catalog bytes [offset, offset + len) back to its segment
+    void saveCatalog(size_t offset, size_t len) {
+        catalogSegment.write(offset, reinterpret_cast<const char*>(&catalog) + offset, len);
+    }
+    
+    // orderCount is excluded: it is written under orderMutex by the booking path
+    void saveCatalogCounts() {
+        saveCatalog(0, offsetof(Catalog, orderCount));
+    }
+    
+    void resetCatalog() {
+        memset(&catalog, 0, sizeof(catalog));
+        catalog.magic = Catalog::MAGIC;
+        saveCatalog(0, sizeof(Catalog));
+    }
+    
+    void ensureRoutes() {
+        if (routesLoaded) return;
+        for (int i = 0; i < catalog.releasedCount; i++) {
             Train train;
-            if (!trains.read(pos, train) || !train.exists) {
-                return pos;
+            loadTrain(catalog.releasedPositions[i], train);
+            addRoute(train);
+        }
+        routesLoaded = true;
+    }
+    
+    // A run's seat block holds its standby queue head and tail followed by
+    // the free seats of every segment between adjacent stations
+    static int runInts(const Train& train) { return train.stationNum + 1; }
+    
+    static long long runOffset(const Train& train, int startDay) {
+        return train.seatOffset + (long long)(startDay - train.saleStart) * runInts(train) * sizeof(int);
+    }
+    
+    std::mutex& userLock(int userPos) { return userLocks[userPos % USER_LOCK_STRIPES]; }
+    
+    std::mutex& runLock(int trainPos, int startDay) {
+        return runLocks[((unsigned int)trainPos * 92821u + (unsigned int)startDay) % RUN_LOCK_STRIPES];
+    }
+    
+    // Gives a newly released train a seat block per day of its sale window
+    void allocateSeats(Train& train) {
+        int block[101];
+        block[0] = block[1] = -1;
+        for (int i = 0; i < train.stationNum - 1; i++) block[2 + i] = train.seatNum;
+        train.seatOffset = seats.size();
+        for (int day = train.saleStart; day <= train.saleEnd; day++) {
+            seats.write(runOffset(train, day), block, runInts(train) * sizeof(int));
+        }
+    }
+    
+    static int minSeats(const int* block, int fromIdx, int toIdx) {
+        int seatsLeft = block[2 + fromIdx];
+        for (int i = fromIdx + 1; i < toIdx; i++) {
+            if (block[2 + i] < seatsLeft) seatsLeft = block[2 + i];
+        }
+        return seatsLeft;
+    }
+    
+    // Keys of versioned records: seat blocks by offset, orders, per-user order heads
+    static long long seatKey(long long offset) { return offset; }
+    static long long orderKey(int id) { return 1LL << 56 | id; }
+    static long long headKey(int userPos) { return 2LL << 56 | userPos; }
+    
+    // Free seats from fromIdx to toIdx in the ints-long seat block at offset, as of the snapshot
+    int runSeats(long long offset, int ints, int fromIdx, int toIdx, const VersionStore::Snapshot& snapshot) {
+        int block[101];
+        seats.read(offset, block, ints * sizeof(int));
+        snapshot.read(seatKey(offset), block, ints * sizeof(int));
+        return minSeats(block, fromIdx, toIdx);
+    }
+    
+    // Free seats from fromIdx to toIdx on one run as of the snapshot
+    int availableSeats(const Train& train, int startDay, int fromIdx, int toIdx,
+                       const VersionStore::Snapshot& snapshot) {
+        if (train.seatOffset < 0) return train.seatNum;
+        return runSeats(runOffset(train, startDay), runInts(train), fromIdx, toIdx, snapshot);
+    }
+    
+    void saveRun(VersionStore::Transaction& txn, long long offset, const int* block, const Train& train) {
+        txn.save(seatKey(offset), block, runInts(train) * sizeof(int));
+    }
+    
+    int allocateOrder() {
+        std::lock_guard<std::mutex> guard(orderMutex);
+        int id = catalog.orderCount++;
+        saveCatalog(offsetof(Catalog, orderCount), sizeof(int));
+        return id;
+    }
+    
+    int newestOrder(int userPos) {
+        if (userOrders.size() < (long long)((userPos + 1) * sizeof(int))) return -1;
+        int head;
+        userOrders.read((long long)userPos * sizeof(int), &head, sizeof(int));
+        return head - 1;
+    }
+    
+    int newestOrder(int userPos, const VersionStore::Snapshot& snapshot) {
+        int head = newestOrder(userPos) + 1;
+        snapshot.read(headKey(userPos), &head, sizeof(int));
+        return head - 1;
+    }
+    
+    void setNewestOrder(VersionStore::Transaction& txn, int userPos, int id) {
+        int before = newestOrder(userPos) + 1;
+        txn.save(headKey(userPos), &before, sizeof(int));
+        int head = id + 1;
+        userOrders.write((long long)userPos * sizeof(int), &head, sizeof(int));
+    }
+    
+    void readOrder(int id, Order& order, const VersionStore::Snapshot& snapshot) {
+        orders.read(id, order);
+        snapshot.read(orderKey(id), &order, sizeof(Order));
+    }
+    
+    void saveOrder(VersionStore::Transaction& txn, int id) {
+        Order before;
+        orders.read(id, before);
+        txn.save(orderKey(id), &before, sizeof(Order));
+    }
+    
+    char orderStatus(int id) {
+        char status;
+        orders.readField(id, offsetof(Order, status), &status, sizeof(status));
+        return status;
+    }
+    
+    void setOrderStatus(VersionStore::Transaction& txn, int id, char status) {
+        saveOrder(txn, id);
+        orders.writeField(id, offsetof(Order, status), &status, sizeof(status));
+    }
+    
+    void setQueueNext(VersionStore::Transaction& txn, int id, int next) {
+        saveOrder(txn, id);
+        orders.writeField(id, offsetof(Order, queueNext), &next, sizeof(next));
+    }
+    
+    void invalidateRun(int trainPos, int startDay) {
+        std::lock_guard<std::mutex> guard(cacheMutex);
+        seatEpoch++;
+        queryCache.invalidateSeats(trainPos, startDay);
+    }
+    
+    // Serves pending orders of a run in queue order; caller holds the run lock
+    // and has saved the block in txn
+    void fillStandby(VersionStore::Transaction& txn, int* block) {
+        int prev = -1;
+        int id = block[0];
+        while (id != -1) {
+            Order order;
+            orders.read(id, order);
+            bool done = order.status != ORDER_PENDING;
+            if (!done && minSeats(block, order.fromIdx, order.toIdx) >= order.num) {
+                for (int i = order.fromIdx; i < order.toIdx; i++) block[2 + i] -= order.num;
+                setOrderStatus(txn, id, ORDER_SUCCESS);
+                done = true;
             }
-            if (strcmp(train.trainID, trainID.c_str()) == 0) {
-                return pos;
+            if (done) {
+                // Unlink served and refunded orders
+                if (prev == -1) block[0] = order.queueNext;
+                else setQueueNext(txn, prev, order.queueNext);
+                if (block[1] == id) block[1] = prev;
+            } else {
+                prev = id;
             }
+            id = order.queueNext;
         }
-        return -1;
+    }
+    
+    // Takes the slot of a deleted train if there is one
+    int createTrain(const TrainID& trainID) {
+        bool reuse = catalog.freeSlotCount > 0;
+        int pos = reuse ? catalog.freeSlots[catalog.freeSlotCount - 1] : catalog.trainSlots;
+        if (catalog.trainCount >= MAX_TRAINS || !trainIndex.insert(trainID, pos)) return -1;
+        if (reuse) catalog.freeSlotCount--;
+        else catalog.trainSlots++;
+        return pos;
     }
     
 public:
-    TicketSystem() : users("users.dat"), trains("trains.dat"), userCount(0), trainCount(0) {
+    // Opens or creates the database at path
+    explicit TicketSystem(const std::string& path = "ticket.db")
+        : pager(path), users(pager, "users"), trains(pager, "trains"), trainHeap(pager, "train_heap"),
+          userFilter(pager, "user_bloom"), trainFilter(pager, "train_bloom"),
+          userIndex(pager, "user_index"), trainIndex(pager, "train_index"), catalogSegment(pager, "catalog"),
+          seats(pager, "seats"), orders(pager, "orders"), userOrders(pager, "user_orders"),
+          memory(MEMORY_LIMIT), commandsSinceRebalance(0), memoryReport(false), seatEpoch(0) {
         memset(loggedIn, 0, sizeof(loggedIn));
-        memset(trainPositions, -1, sizeof(trainPositions));
+        catalog.magic = 0;
+        if (catalogSegment.size() >= (long long)sizeof(Catalog)) {
+            catalogSegment.read(0, &catalog, sizeof(Catalog));
+        }
+        if (catalog.magic != Catalog::MAGIC) resetCatalog();
+        // The planner is rebuilt from the released list on first use
+        routesLoaded = catalog.releasedCount == 0;
+        
+        memory.addCache("page_cache", &pager, MIN_POOL_PAGES * PAGE_SIZE, 16 * MEBIBYTE);
+        memory.addCache("query_cache", &queryCache, queryCache.memoryUsage() + MEBIBYTE / 4, 12 * MEBIBYTE);
+        memory.addConsumer("route_planner", &planner);
+        memory.addConsumer("versions", &versions);
+        memory.addFixed("sessions", sizeof(loggedIn));
+        memory.addFixed("catalog", sizeof(catalog));
+        memory.addFixed("user_bloom", userFilter.memoryUsage());
+        memory.addFixed("train_bloom", trainFilter.memoryUsage());
+        memory.addConsumer("user_index", &userIndex);
+        memory.addConsumer("train_index", &trainIndex);
+        memory.addConsumer("train_heap", &trainHeap);
+        memory.addFixed("workers", sizeof(workers));
+        memory.addFixed("booking_locks", sizeof(userLocks) + sizeof(runLocks));
+    }
+    
+    // Registers memory owned outside the system, such as the input reader;
+    // false if the governor has no account left for it
+    bool accountMemory(const char* name, long long bytes) {
+        return memory.addFixed(name, bytes);
+    }
+    
+    void setMemoryLimit(long long bytes) {
+        memory.setLimit(bytes);
+    }
+    
+    // Prints per-cache usage to stderr on exit
+    void enableMemoryReport() {
+        memoryReport = true;
+    }
+    
+    void reportMemory() {
+        if (memoryReport) memory.report(std::cerr);
+    }
+    
+    // Writes every cached page back to disk
+    void flush() {
+        pager.flush();
+    }
+    
+    // Moves page write-back to a background thread; dirtyBudget <= 0 keeps the default
+    void enableWriteBack(int dirtyBudget) {
+        pager.startWriteBack(dirtyBudget);
+    }
+    
+    // Batched page I/O through io_uring; false if unavailable, leaving it synchronous
+    bool enableIoRing() {
+        return pager.useIoRing();
+    }
+    
+    // Pages cached only by the pager, bypassing the OS; false if the file system refuses
+    bool enableDirectIo() {
+        return pager.useDirectIo();
+    }
+    
+    // Threads used to evaluate large query fan-outs; 0 means one per core
+    void setWorkers(int count) {
+        workers.setWorkerCount(count);
+    }
+    
+    // Sends replies of commands run on the calling thread to stream; nullptr restores std::cout
+    static void setReplyStream(std::ostream* stream) {
+        replyTarget() = stream ? stream : &std::cout;
+    }
+    
+    // User slot a booking command reads and writes, or -1
+    int commandUser(Command& command) {
+        if (command.name != "buy_ticket" && command.name != "refund_ticket") return -1;
+        return findUser(UserName(getParam('u', command.keys, command.values, command.count)));
+    }
+    
+    // Shard owning the single train a command touches, or -1 if it must run
+    // alone. A refund belongs to the train of the order it refunds, so the
+    // user's earlier commands must have finished before this is called.
+    int commandShard(Command& command, int shardCount) {
+        if (command.name == "buy_ticket" || command.name == "query_train") {
+            return TrainID(getParam('i', command.keys, command.values, command.count)).hash() % shardCount;
+        }
+        if (command.name != "refund_ticket") return -1;
+        int userPos = commandUser(command);
+        std::string nthStr = getParam('n', command.keys, command.values, command.count);
+        int nth = nthStr.empty() ? 1 : std::stoi(nthStr);
+        int id = userPos == -1 ? -1 : newestOrder(userPos);
+        Order order;
+        for (int i = 0; id != -1; i++) {
+            orders.read(id, order);
+            if (i == nth - 1) return order.trainID.hash() % shardCount;
+            id = order.userPrev;
+        }
+        return 0;  // Fails wherever it runs
     }
     
     void processCommand(const std::string& cmdLine) {
-        std::istringstream iss(cmdLine);
-        std::string cmd;
-        iss >> cmd;
+        Command command;
+        tokenizeCommand(cmdLine.data(), cmdLine.size(), command);
+        processCommand(command);
+    }
+    
+    void processCommand(Command& command) {
+        // Only the caller that reaches the interval rebalances
+        if (++commandsSinceRebalance % REBALANCE_INTERVAL == 0) {
+            std::lock_guard<std::mutex> guard(cacheMutex);
+            memory.rebalance();
+        }
         
-        char keys[20];
-        std::string values[20];
-        int paramCount;
-        parseCommand(cmdLine, keys, values, paramCount);
+        const std::string& cmd = command.name;
+        char* keys = command.keys;
+        std::string* values = command.values;
+        int paramCount = command.count;
         
         if (cmd == "add_user") {
             handleAddUser(keys, values, paramCount);
@@ -403,6 +890,8 @@ public:
             handleQueryTicket(keys, values, paramCount);
         } else if (cmd == "query_transfer") {
             handleQueryTransfer(keys, values, paramCount);
+        } else if (cmd == "query_route") {
+            handleQueryRoute(keys, values, paramCount);
         } else if (cmd == "buy_ticket") {
             handleBuyTicket(keys, values, paramCount);
         } else if (cmd == "query_order") {
@@ -426,32 +915,37 @@ public:
         int privilege = privStr.empty() ? 10 : std::stoi(privStr);
         
         // Check if first user
-        if (userCount == 0) {
+        if (catalog.userCount == 0) {
             User user;
-            strcpy(user.username, username.c_str());
+            user.username = username;
             strcpy(user.password, password.c_str());
             strcpy(user.name, name.c_str());
             strcpy(user.mailAddr, mailAddr.c_str());
             user.privilege = 10;
             user.exists = true;
             
-            int pos = findOrCreateUser(username);
+            int pos = createUser(user.username);
+            if (pos == -1) {
+                reply() << "-1\n";
+                return;
+            }
             users.write(pos, user);
-            userCount++;
-            std::cout << "0\n";
+            catalog.userCount++;
+            saveCatalogCounts();
+            reply() << "0\n";
             return;
         }
         
         // Check if user already exists
         if (findUser(username) != -1) {
-            std::cout << "-1\n";
+            reply() << "-1\n";
             return;
         }
         
         // Check current user permission
         int curPos = findUser(curUsername);
         if (curPos == -1) {
-            std::cout << "-1\n";
+            reply() << "-1\n";
             return;
         }
         
@@ -459,27 +953,32 @@ public:
         users.read(curPos, curUser);
         
         if (!loggedIn[curPos]) {
-            std::cout << "-1\n";
+            reply() << "-1\n";
             return;
         }
         
         if (privilege >= curUser.privilege) {
-            std::cout << "-1\n";
+            reply() << "-1\n";
             return;
         }
         
         User user;
-        strcpy(user.username, username.c_str());
+        user.username = username;
         strcpy(user.password, password.c_str());
         strcpy(user.name, name.c_str());
         strcpy(user.mailAddr, mailAddr.c_str());
         user.privilege = privilege;
         user.exists = true;
         
-        int pos = findOrCreateUser(username);
+        int pos = createUser(user.username);
+        if (pos == -1) {
+            reply() << "-1\n";
+            return;
+        }
         users.write(pos, user);
-        userCount++;
-        std::cout << "0\n";
+        catalog.userCount++;
+        saveCatalogCounts();
+        reply() << "0\n";
     }
     
     void handleLogin(char keys[20], std::string values[20], int count) {
@@ -488,7 +987,7 @@ public:
         
         int pos = findUser(username);
         if (pos == -1) {
-            std::cout << "-1\n";
+            reply() << "-1\n";
             return;
         }
         
@@ -496,17 +995,17 @@ public:
         users.read(pos, user);
         
         if (strcmp(user.password, password.c_str()) != 0) {
-            std::cout << "-1\n";
+            reply() << "-1\n";
             return;
         }
         
         if (loggedIn[pos]) {
-            std::cout << "-1\n";
+            reply() << "-1\n";
             return;
         }
         
         loggedIn[pos] = true;
-        std::cout << "0\n";
+        reply() << "0\n";
     }
     
     void handleLogout(char keys[20], std::string values[20], int count) {
@@ -514,12 +1013,12 @@ public:
         
         int pos = findUser(username);
         if (pos == -1 || !loggedIn[pos]) {
-            std::cout << "-1\n";
+            reply() << "-1\n";
             return;
         }
         
         loggedIn[pos] = false;
-        std::cout << "0\n";
+        reply() << "0\n";
     }
     
     void handleQueryProfile(char keys[20], std::string values[20], int count) {
@@ -530,12 +1029,12 @@ public:
         int userPos = findUser(username);
         
         if (curPos == -1 || userPos == -1) {
-            std::cout << "-1\n";
+            reply() << "-1\n";
             return;
         }
         
         if (!loggedIn[curPos]) {
-            std::cout << "-1\n";
+            reply() << "-1\n";
             return;
         }
         
@@ -543,12 +1042,12 @@ public:
         users.read(curPos, curUser);
         users.read(userPos, user);
         
-        if (curUser.privilege <= user.privilege && strcmp(curUser.username, user.username) != 0) {
-            std::cout << "-1\n";
+        if (curUser.privilege <= user.privilege && curUser.username != user.username) {
+            reply() << "-1\n";
             return;
         }
         
-        std::cout << user.username << " " << user.name << " " << user.mailAddr << " " << user.privilege << "\n";
+        reply() << user.username << " " << user.name << " " << user.mailAddr << " " << user.privilege << "\n";
     }
     
     void handleModifyProfile(char keys[20], std::string values[20], int count) {
@@ -563,12 +1062,12 @@ public:
         int userPos = findUser(username);
         
         if (curPos == -1 || userPos == -1) {
-            std::cout << "-1\n";
+            reply() << "-1\n";
             return;
         }
         
         if (!loggedIn[curPos]) {
-            std::cout << "-1\n";
+            reply() << "-1\n";
             return;
         }
         
@@ -576,8 +1075,8 @@ public:
         users.read(curPos, curUser);
         users.read(userPos, user);
         
-        if (curUser.privilege <= user.privilege && strcmp(curUser.username, user.username) != 0) {
-            std::cout << "-1\n";
+        if (curUser.privilege <= user.privilege && curUser.username != user.username) {
+            reply() << "-1\n";
             return;
         }
         
@@ -593,26 +1092,26 @@ public:
         if (!privStr.empty()) {
             int privilege = std::stoi(privStr);
             if (privilege >= curUser.privilege) {
-                std::cout << "-1\n";
+                reply() << "-1\n";
                 return;
             }
             user.privilege = privilege;
         }
         
         users.write(userPos, user);
-        std::cout << user.username << " " << user.name << " " << user.mailAddr << " " << user.privilege << "\n";
+        reply() << user.username << " " << user.name << " " << user.mailAddr << " " << user.privilege << "\n";
     }
     
     void handleAddTrain(char keys[20], std::string values[20], int count) {
         std::string trainID = getParam('i', keys, values, count);
         
         if (findTrain(trainID) != -1) {
-            std::cout << "-1\n";
+            reply() << "-1\n";
             return;
         }
         
         Train train;
-        strcpy(train.trainID, trainID.c_str());
+        train.trainID = trainID;
         train.exists = true;
         
         train.stationNum = std::stoi(getParam('n', keys, values, count));
@@ -628,9 +1127,7 @@ public:
             train.prices[i] = std::stoi(prices[i]);
         }
         
-        std::string startTime = getParam('x', keys, values, count);
-        train.startHour = std::stoi(startTime.substr(0, 2));
-        train.startMinute = std::stoi(startTime.substr(3, 2));
+        train.startTime = parseClock(getParam('x', keys, values, count).c_str());
         
         Vector<std::string> travels = split(getParam('t', keys, values, count), '|');
         for (int i = 0; i < travels.size(); i++) {
@@ -646,17 +1143,23 @@ public:
         }
         
         Vector<std::string> dates = split(getParam('d', keys, values, count), '|');
-        train.saleStart = dateToDay(dates[0]);
-        train.saleEnd = dateToDay(dates[1]);
+        train.saleStart = parseDate(dates[0].c_str());
+        train.saleEnd = parseDate(dates[1].c_str());
         
         train.type = getParam('y', keys, values, count)[0];
         train.released = false;
         
-        int pos = findOrCreateTrain(trainID);
-        trains.write(pos, train);
-        trainPositions[trainCount] = pos;
-        trainCount++;
-        std::cout << "0\n";
+        int pos = createTrain(train.trainID);
+        if (pos == -1) {
+            reply() << "-1\n";
+            return;
+        }
+        storeTrain(pos, train);
+        catalog.trainPositions[catalog.trainCount] = pos;
+        saveCatalog(offsetof(Catalog, trainPositions) + catalog.trainCount * sizeof(int), sizeof(int));
+        catalog.trainCount++;
+        saveCatalogCounts();
+        reply() << "0\n";
     }
     
     void handleReleaseTrain(char keys[20], std::string values[20], int count) {
@@ -664,21 +1167,34 @@ public:
         
         int pos = findTrain(trainID);
         if (pos == -1) {
-            std::cout << "-1\n";
+            reply() << "-1\n";
             return;
         }
         
-        Train train;
+        TrainRecord train;
         trains.read(pos, train);
         
         if (train.released) {
-            std::cout << "-1\n";
+            reply() << "-1\n";
             return;
         }
         
+        Train released;
+        loadTrain(pos, released);
+        allocateSeats(released);
+        char blob[MAX_TIMETABLE];
         train.released = true;
+        train.seatOffset = released.seatOffset;
+        train.timetableLength = renderTimetable(released, blob);
+        train.timetableRid = trainHeap.insert(blob, train.timetableLength);
         trains.write(pos, train);
-        std::cout << "0\n";
+        queryCache.invalidateStations(released.stations, released.stationNum);
+        catalog.releasedPositions[catalog.releasedCount] = pos;
+        saveCatalog(offsetof(Catalog, releasedPositions) + catalog.releasedCount * sizeof(int), sizeof(int));
+        catalog.releasedCount++;
+        saveCatalogCounts();
+        if (routesLoaded) addRoute(released);
+        reply() << "0\n";
     }
     
     void handleQueryTrain(char keys[20], std::string values[20], int count) {
@@ -687,46 +1203,54 @@ public:
         
         int pos = findTrain(trainID);
         if (pos == -1) {
-            std::cout << "-1\n";
+            reply() << "-1\n";
             return;
         }
         
-        Train train;
-        trains.read(pos, train);
-        
-        int queryDay = dateToDay(dateStr);
-        
-        std::cout << train.trainID << " " << train.type << "\n";
+        // Unreleased trains are rendered on the spot
+        TrainRecord record;
+        trains.read(pos, record);
+        char blob[MAX_TIMETABLE];
+        if (record.timetableLength > 0) {
+            trainHeap.read(record.timetableRid, blob);
+        } else {
+            Train train;
+            loadTrain(pos, train);
+            renderTimetable(train, blob);
+        }
+        TimetableHeader header;
+        memcpy(&header, blob, sizeof(header));
+        TimetableLine lines[100];
+        memcpy(lines, blob + sizeof(header), header.stationNum * sizeof(TimetableLine));
+        const char* text = blob + sizeof(header) + header.stationNum * sizeof(TimetableLine);
+        
+        int queryDay = parseDate(dateStr.c_str());
+        bool onSale = record.released && queryDay >= header.saleStart && queryDay <= header.saleEnd;
+        int block[101];
+        if (onSale) {
+            VersionStore::Snapshot snapshot(versions);
+            int ints = header.stationNum + 1;
+            long long offset = record.seatOffset + (long long)(queryDay - header.saleStart) * ints * sizeof(int);
+            seats.read(offset, block, ints * sizeof(int));
+            snapshot.read(seatKey(offset), block, ints * sizeof(int));
+        }
         
-        for (int i = 0; i < train.stationNum; i++) {
-            std::cout << train.stations[i] << " ";
-            
-            if (i == 0) {
-                std::cout << "xx-xx xx:xx";
-            } else {
-                DateTime arriveTime = train.getArriveTime(i, queryDay);
-                std::cout << arriveTime.toString();
-            }
-            
-            std::cout << " -> ";
-            
-            if (i == train.stationNum - 1) {
-                std::cout << "xx-xx xx:xx";
-            } else {
-                DateTime leaveTime = train.getLeaveTime(i, queryDay);
-                std::cout << leaveTime.toString();
-            }
-            
-            std::cout << " " << train.getCumulativePrice(0, i) << " ";
-            
-            if (i == train.stationNum - 1) {
-                std::cout << "x";
-            } else {
-                std::cout << train.seatNum;
-            }
-            
-            std::cout << "\n";
+        char output[MAX_TIMETABLE];
+        memcpy(output, text, header.titleLength);
+        text += header.titleLength;
+        char* out = output + header.titleLength;
+        for (int i = 0; i < header.stationNum; i++) {
+            const TimetableLine& slots = lines[i];
+            memcpy(out, text, slots.length);
+            text += slots.length;
+            if (slots.arriveDate >= 0) formatDate(out + slots.arriveDate, queryDay + slots.arriveDays);
+            if (slots.leaveDate >= 0) formatDate(out + slots.leaveDate, queryDay + slots.leaveDays);
+            out += slots.length;
+            if (i == header.stationNum - 1) *out++ = 'x';
+            else out = formatInt(out, onSale ? block[2 + i] : header.seatNum);
+            *out++ = '\n';
         }
+        reply().write(output, out - output);
     }
     
     void handleDeleteTrain(char keys[20], std::string values[20], int count) {
@@ -734,24 +1258,42 @@ public:
         
         int pos = findTrain(trainID);
         if (pos == -1) {
-            std::cout << "-1\n";
+            reply() << "-1\n";
             return;
         }
         
-        Train train;
+        TrainRecord train;
         trains.read(pos, train);
         
         if (train.released) {
-            std::cout << "-1\n";
+            reply() << "-1\n";
             return;
         }
         
+        // Unreleased, so nothing else refers to the slot and its data can go
         train.exists = false;
         trains.write(pos, train);
-        trainCount--;
-        std::cout << "0\n";
+        trainIndex.erase(train.trainID);
+        trainHeap.erase(train.dataRid);
+        catalog.freeSlots[catalog.freeSlotCount] = pos;
+        saveCatalog(offsetof(Catalog, freeSlots) + catalog.freeSlotCount * sizeof(int), sizeof(int));
+        catalog.freeSlotCount++;
+        
+        // Drop the slot from the train list, keeping the others in order
+        int idx = 0;
+        while (catalog.trainPositions[idx] != pos) idx++;
+        for (int i = idx; i + 1 < catalog.trainCount; i++) {
+            catalog.trainPositions[i] = catalog.trainPositions[i + 1];
+        }
+        catalog.trainCount--;
+        saveCatalog(offsetof(Catalog, trainPositions) + idx * sizeof(int), (catalog.trainCount - idx) * sizeof(int));
+        saveCatalogCounts();
+        reply() << "0\n";
     }
     
+    // query_ticket -s -t -d (-p time). -d may also be a range "mm-dd|mm-dd":
+    // the reply is then the single-day reply of each day in turn, computed
+    // in one pass that matches stations and decodes trains once.
     void handleQueryTicket(char keys[20], std::string values[20], int count) {
         std::string from = getParam('s', keys, values, count);
         std::string to = getParam('t', keys, values, count);
@@ -759,69 +1301,258 @@ public:
         std::string sortBy = getParam('p', keys, values, count);
         if (sortBy.empty()) sortBy = "time";
         
-        int queryDay = dateToDay(dateStr);
-        
-        // Collect matching trains
-        Vector<int> matches;
-        for (int idx = 0; idx < trainCount; idx++) {
-            int i = trainPositions[idx];
-            if (i == -1) continue;
+        int firstDay = parseDate(dateStr.c_str());
+        int lastDay = dateStr.size() == 11 && dateStr[5] == '|' ? parseDate(dateStr.c_str() + 6) : firstDay;
+        if (lastDay < firstDay || lastDay - firstDay >= MAX_DATES) {
+            reply() << "-1\n";
+            return;
+        }
+        int days = lastDay - firstDay + 1;
+        StationName fromName(from), toName(to);
+        bool byCost = sortBy == "cost";
+        
+        // A result is only cached if no seat changed while it was computed
+        long long epoch;
+        bool cachedCandidates = false;
+        Vector<CandidateTrain> scanned;
+        std::string outputs[MAX_DATES];
+        bool wanted[MAX_DATES];  // Not answered from the cache
+        {
+            std::lock_guard<std::mutex> guard(cacheMutex);
+            int pending = 0;
+            for (int d = 0; d < days; d++) {
+                const std::string* cached = queryCache.findResult(fromName, toName, firstDay + d, byCost);
+                wanted[d] = !cached;
+                if (cached) outputs[d] = *cached;
+                else pending++;
+            }
+            if (pending == 0) {
+                for (int d = 0; d < days; d++) reply() << outputs[d];
+                return;
+            }
+            epoch = seatEpoch;
             
-            Train train;
-            if (trains.read(i, train) && train.exists && train.released) {
+            // Trains serving the station pair, independent of the date
+            int cachedCount = 0;
+            const CandidateTrain* list = queryCache.findCandidates(fromName, toName, cachedCount);
+            if (list) {
+                cachedCandidates = true;
+                for (int c = 0; c < cachedCount; c++) scanned.push_back(list[c]);
+            }
+        }
+        if (!cachedCandidates) {
+            // Slot idx holds the match for catalog.trainPositions[idx], so merging in
+            // index order gives the same list as a serial scan
+            int total = catalog.trainCount > 0 ? catalog.trainCount : 1;
+            CandidateTrain* found = new CandidateTrain[total];
+            TrainRecord* records = new TrainRecord[total];
+            long long* dataAt = new long long[total];
+            unsigned char* data = readReleasedTrains(catalog.trainPositions, catalog.trainCount, records, dataAt);
+            auto scan = [&](int idx, int) {
+                found[idx].trainPos = -1;
+                if (dataAt[idx] == -1) return;
+                
+                Train train;
+                decodeTrain(records[idx], data + dataAt[idx], train);
                 int fromIdx = -1, toIdx = -1;
                 for (int j = 0; j < train.stationNum; j++) {
                     if (from == train.stations[j]) fromIdx = j;
                     if (to == train.stations[j]) toIdx = j;
                 }
-                
                 if (fromIdx != -1 && toIdx != -1 && fromIdx < toIdx) {
-                    // Calculate the offset from start day to departure day at 'from' station
-                    DateTime leaveTime = train.getLeaveTime(fromIdx, 0);
-                    int offsetDays = leaveTime.toMinutes() / (24 * 60);
-                    
-                    // Calculate which start day corresponds to queryDay departure from 'from'
-                    int requiredStartDay = queryDay - offsetDays;
-                    
-                    // Check if this start day is in the valid sale range
-                    if (requiredStartDay >= train.saleStart && requiredStartDay <= train.saleEnd) {
-                        matches.push_back(i);
-                    }
+                    found[idx] = CandidateTrain{catalog.trainPositions[idx], fromIdx, toIdx};
                 }
+            };
+            workers.run(catalog.trainCount, scan);
+            for (int idx = 0; idx < catalog.trainCount; idx++) {
+                if (found[idx].trainPos != -1) scanned.push_back(found[idx]);
             }
+            delete[] found;
+            delete[] records;
+            delete[] dataAt;
+            delete[] data;
+            std::lock_guard<std::mutex> guard(cacheMutex);
+            queryCache.putCandidates(fromName, toName, scanned.begin(), scanned.size());
+        }
+        const CandidateTrain* candidates = scanned.begin();
+        int candidateCount = scanned.size();
+        
+        // Taken after reading the epoch, so a result that misses a commit is never cached
+        VersionStore::Snapshot snapshot(versions);
+        
+        // What every day needs from a candidate, decoded once
+        struct Fare {
+            TrainID trainID;  // Empty: not released
+            TimePoint leaveOffset, arriveOffset;  // From midnight of the start day
+            int price;
+            int saleStart, saleEnd;
+            long long seatOffset;
+            int runInts;
+            int seatNum;
+        };
+        Fare* fares = new Fare[candidateCount > 0 ? candidateCount : 1];
+        {
+            int* candidatePositions = new int[candidateCount > 0 ? candidateCount : 1];
+            TrainRecord* candidateRecords = new TrainRecord[candidateCount > 0 ? candidateCount : 1];
+            long long* candidateDataAt = new long long[candidateCount > 0 ? candidateCount : 1];
+            for (int c = 0; c < candidateCount; c++) candidatePositions[c] = candidates[c].trainPos;
+            unsigned char* candidateData =
+                readReleasedTrains(candidatePositions, candidateCount, candidateRecords, candidateDataAt);
+            auto summarize = [&](int c, int) {
+                Fare& fare = fares[c];
+                fare.trainID = TrainID();
+                if (candidateDataAt[c] == -1) return;
+                Train train;
+                decodeTrain(candidateRecords[c], candidateData + candidateDataAt[c], train);
+                fare.trainID = train.trainID;
+                fare.leaveOffset = train.getLeaveTime(candidates[c].fromIdx, 0);
+                fare.arriveOffset = train.getArriveTime(candidates[c].toIdx, 0);
+                fare.price = train.getCumulativePrice(candidates[c].fromIdx, candidates[c].toIdx);
+                fare.saleStart = train.saleStart;
+                fare.saleEnd = train.saleEnd;
+                fare.seatOffset = train.seatOffset;
+                fare.runInts = runInts(train);
+                fare.seatNum = train.seatNum;
+            };
+            workers.run(candidateCount, summarize);
+            delete[] candidatePositions;
+            delete[] candidateRecords;
+            delete[] candidateDataAt;
+            delete[] candidateData;
         }
         
-        std::cout << matches.size() << "\n";
-        
-        for (int i = 0; i < matches.size(); i++) {
-            Train train;
-            trains.read(matches[i], train);
+        // Keep the trains whose run leaving 'from' is on sale, one wanted day
+        // at a time, so nothing here grows with the range. Workers format into
+        // their own buffers; results are then merged in candidate order.
+        struct Match {
+            int worker;
+            int offset, length;  // -1 length: not on sale that day
+            int startDay;
+        };
+        Match* matches = new Match[candidateCount > 0 ? candidateCount : 1];
+        std::string buffers[WorkerPool::MAX_WORKERS];
+        Vector<int> matchPositions, matchStartDays;
+        for (int d = 0; d < days; d++) {
+            if (!wanted[d]) continue;
+            int day = firstDay + d;
+            auto evaluate = [&](int c, int worker) {
+                const Fare& fare = fares[c];
+                matches[c].length = -1;
+                if (fare.trainID.empty()) return;
+                int startDay = day - fare.leaveOffset / MINUTES_PER_DAY;
+                if (startDay < fare.saleStart || startDay > fare.saleEnd) return;
+                int seatsLeft = fare.seatNum;
+                if (fare.seatOffset >= 0) {
+                    long long offset =
+                        fare.seatOffset + (long long)(startDay - fare.saleStart) * fare.runInts * sizeof(int);
+                    seatsLeft = runSeats(offset, fare.runInts, candidates[c].fromIdx, candidates[c].toIdx, snapshot);
+                }
+                
+                char line[160];
+                char* out = formatText(line, fare.trainID.c_str());
+                *out++ = ' ';
+                out = formatText(out, from.c_str());
+                *out++ = ' ';
+                out = formatTime(out, fare.leaveOffset + startDay * MINUTES_PER_DAY);
+                out = formatText(out, " -> ");
+                out = formatText(out, to.c_str());
+                *out++ = ' ';
+                out = formatTime(out, fare.arriveOffset + startDay * MINUTES_PER_DAY);
+                *out++ = ' ';
+                out = formatInt(out, fare.price);
+                *out++ = ' ';
+                out = formatInt(out, seatsLeft);
+                *out++ = '\n';
+                Match& match = matches[c];
+                match.worker = worker;
+                match.offset = buffers[worker].size();
+                match.length = out - line;
+                match.startDay = startDay;
+                buffers[worker].append(line, out - line);
+            };
+            workers.run(candidateCount, evaluate);
             
-            int fromIdx = -1, toIdx = -1;
-            for (int j = 0; j < train.stationNum; j++) {
-                if (from == train.stations[j]) fromIdx = j;
-                if (to == train.stations[j]) toIdx = j;
+            std::string lines;
+            matchPositions.clear();
+            matchStartDays.clear();
+            for (int c = 0; c < candidateCount; c++) {
+                const Match& match = matches[c];
+                if (match.length == -1) continue;
+                lines.append(buffers[match.worker], match.offset, match.length);
+                matchPositions.push_back(candidates[c].trainPos);
+                matchStartDays.push_back(match.startDay);
             }
+            for (int w = 0; w < WorkerPool::MAX_WORKERS; w++) buffers[w].clear();
+            outputs[d] = std::to_string(matchPositions.size()) + "\n" + lines;
             
-            // Calculate the correct start day
-            DateTime leaveTimeOffset = train.getLeaveTime(fromIdx, 0);
-            int offsetDays = leaveTimeOffset.toMinutes() / (24 * 60);
-            int startDay = queryDay - offsetDays;
-            
-            DateTime leaveTime = train.getLeaveTime(fromIdx, startDay);
-            DateTime arriveTime = train.getArriveTime(toIdx, startDay);
-            int price = train.getCumulativePrice(fromIdx, toIdx);
-            
-            std::cout << train.trainID << " " << from << " " << leaveTime.toString() 
-                     << " -> " << to << " " << arriveTime.toString() 
-                     << " " << price << " " << train.seatNum << "\n";
+            std::lock_guard<std::mutex> guard(cacheMutex);
+            if (epoch == seatEpoch) {
+                queryCache.putResult(fromName, toName, day, byCost, outputs[d], matchPositions.begin(),
+                                     matchStartDays.begin(), matchPositions.size());
+            }
         }
+        delete[] matches;
+        delete[] fares;
+        
+        for (int d = 0; d < days; d++) reply() << outputs[d];
     }
     
     void handleQueryTransfer(char keys[20], std::string values[20], int count) {
-        std::cout << "0\n";
+        reply() << "0\n";
+    }
+    
+    // query_route -s -t -d (-p time) (-k 2): best journey with at most -k transfers.
+    // Prints the number of legs, then one query_ticket-style line per leg,
+    // seats included.
+    void handleQueryRoute(char keys[20], std::string values[20], int count) {
+        std::string from = getParam('s', keys, values, count);
+        std::string to = getParam('t', keys, values, count);
+        std::string dateStr = getParam('d', keys, values, count);
+        std::string sortBy = getParam('p', keys, values, count);
+        std::string transferStr = getParam('k', keys, values, count);
+        int maxTransfers = transferStr.empty() ? 2 : std::stoi(transferStr);
+        if (maxTransfers < 0) maxTransfers = 0;
+        if (maxTransfers > MAX_ROUTE_TRANSFERS) maxTransfers = MAX_ROUTE_TRANSFERS;
+        
+        ensureRoutes();
+        RouteLeg legs[MAX_ROUTE_TRANSFERS + 1];
+        int legCount = planner.plan(StationName(from), StationName(to), parseDate(dateStr.c_str()),
+                                    maxTransfers + 1, sortBy == "cost", legs);
+        
+        // Seats left on each leg's run, as query_ticket reports them
+        int legSeats[MAX_ROUTE_TRANSFERS + 1];
+        {
+            VersionStore::Snapshot snapshot(versions);
+            for (int i = 0; i < legCount; i++) {
+                Train train;
+                loadTrain(findTrain(legs[i].trainID), train);
+                legSeats[i] = availableSeats(train, legs[i].startDay, legs[i].boardIdx, legs[i].alightIdx, snapshot);
+            }
+        }
+        
+        reply() << legCount << "\n";
+        char line[160];
+        for (int i = 0; i < legCount; i++) {
+            char* out = formatText(line, legs[i].trainID.c_str());
+            *out++ = ' ';
+            out = formatText(out, planner.stationName(legs[i].fromStop).c_str());
+            *out++ = ' ';
+            out = formatTime(out, legs[i].leaveTime);
+            out = formatText(out, " -> ");
+            out = formatText(out, planner.stationName(legs[i].toStop).c_str());
+            *out++ = ' ';
+            out = formatTime(out, legs[i].arriveTime);
+            *out++ = ' ';
+            out = formatInt(out, legs[i].price);
+            *out++ = ' ';
+            out = formatInt(out, legSeats[i]);
+            *out++ = '\n';
+            reply().write(line, out - line);
+        }
     }
     
+    // Safe to call from several threads: a purchase holds its user's lock and
+    // the lock of the train run it books, so unrelated purchases run in parallel
     void handleBuyTicket(char keys[20], std::string values[20], int count) {
         std::string username = getParam('u', keys, values, count);
         std::string trainID = getParam('i', keys, values, count);
@@ -829,24 +1560,25 @@ public:
         std::string from = getParam('f', keys, values, count);
         std::string to = getParam('t', keys, values, count);
         int num = std::stoi(getParam('n', keys, values, count));
+        bool standby = getParam('q', keys, values, count) == "true";
         
         int userPos = findUser(username);
         if (userPos == -1 || !loggedIn[userPos]) {
-            std::cout << "-1\n";
+            reply() << "-1\n";
             return;
         }
         
         int trainPos = findTrain(trainID);
         if (trainPos == -1) {
-            std::cout << "-1\n";
+            reply() << "-1\n";
             return;
         }
         
         Train train;
-        trains.read(trainPos, train);
+        loadTrain(trainPos, train);
         
         if (!train.released) {
-            std::cout << "-1\n";
+            reply() << "-1\n";
             return;
         }
         
@@ -857,17 +1589,76 @@ public:
         }
         
         if (fromIdx == -1 || toIdx == -1 || fromIdx >= toIdx) {
-            std::cout << "-1\n";
+            reply() << "-1\n";
             return;
         }
         
         if (num > train.seatNum) {
-            std::cout << "-1\n";
+            reply() << "-1\n";
+            return;
+        }
+        
+        TimePoint leaveOffset = train.getLeaveTime(fromIdx, 0);
+        int startDay = parseDate(dateStr.c_str()) - leaveOffset / MINUTES_PER_DAY;
+        if (startDay < train.saleStart || startDay > train.saleEnd) {
+            reply() << "-1\n";
             return;
         }
         
-        int totalPrice = train.getCumulativePrice(fromIdx, toIdx) * num;
-        std::cout << totalPrice << "\n";
+        Order order;
+        order.trainID = train.trainID;
+        order.from = StationName(from);
+        order.to = StationName(to);
+        order.trainPos = trainPos;
+        order.startDay = startDay;
+        order.fromIdx = fromIdx;
+        order.toIdx = toIdx;
+        order.leaveTime = leaveOffset + startDay * MINUTES_PER_DAY;
+        order.arriveTime = train.getArriveTime(toIdx, startDay);
+        order.price = train.getCumulativePrice(fromIdx, toIdx);
+        order.num = num;
+        order.queueNext = -1;
+        
+        std::lock_guard<std::mutex> userGuard(userLock(userPos));
+        int id;
+        {
+            std::lock_guard<std::mutex> runGuard(runLock(trainPos, startDay));
+            int block[101];
+            long long offset = runOffset(train, startDay);
+            seats.read(offset, block, runInts(train) * sizeof(int));
+            
+            bool fits = minSeats(block, fromIdx, toIdx) >= num;
+            if (!fits && !standby) {
+                reply() << "-1\n";
+                return;
+            }
+            order.status = fits ? ORDER_SUCCESS : ORDER_PENDING;
+            
+            // Commits before the run lock is released
+            VersionStore::Transaction txn(versions);
+            saveRun(txn, offset, block, train);
+            if (fits) {
+                for (int i = fromIdx; i < toIdx; i++) block[2 + i] -= num;
+            }
+            
+            id = allocateOrder();
+            order.userPrev = newestOrder(userPos);
+            orders.write(id, order);
+            if (order.status == ORDER_PENDING) {
+                if (block[1] == -1) block[0] = id;
+                else setQueueNext(txn, block[1], id);
+                block[1] = id;
+            }
+            seats.write(offset, block, runInts(train) * sizeof(int));
+            setNewestOrder(txn, userPos, id);
+        }
+        
+        if (order.status == ORDER_PENDING) {
+            reply() << "queue\n";
+            return;
+        }
+        invalidateRun(trainPos, startDay);
+        reply() << (long long)order.price * num << "\n";
     }
     
     void handleQueryOrder(char keys[20], std::string values[20], int count) {
@@ -875,38 +1666,117 @@ public:
         
         int userPos = findUser(username);
         if (userPos == -1 || !loggedIn[userPos]) {
-            std::cout << "-1\n";
+            reply() << "-1\n";
             return;
         }
         
-        std::cout << "0\n";
+        static const char* const STATUS_TEXT[] = {"[success] ", "[pending] ", "[refunded] "};
+        VersionStore::Snapshot snapshot(versions);
+        std::string lines;
+        int orderCount = 0;
+        char line[200];
+        for (int id = newestOrder(userPos, snapshot); id != -1;) {
+            Order order;
+            readOrder(id, order, snapshot);
+            char* out = formatText(line, STATUS_TEXT[(int)order.status]);
+            out = formatText(out, order.trainID.c_str());
+            *out++ = ' ';
+            out = formatText(out, order.from.c_str());
+            *out++ = ' ';
+            out = formatTime(out, order.leaveTime);
+            out = formatText(out, " -> ");
+            out = formatText(out, order.to.c_str());
+            *out++ = ' ';
+            out = formatTime(out, order.arriveTime);
+            *out++ = ' ';
+            out = formatInt(out, order.price);
+            *out++ = ' ';
+            out = formatInt(out, order.num);
+            *out++ = '\n';
+            lines.append(line, out - line);
+            orderCount++;
+            id = order.userPrev;
+        }
+        reply() << orderCount << "\n" << lines;
     }
     
+    // Safe to call from several threads, like handleBuyTicket
     void handleRefundTicket(char keys[20], std::string values[20], int count) {
         std::string username = getParam('u', keys, values, count);
+        std::string nthStr = getParam('n', keys, values, count);
+        int nth = nthStr.empty() ? 1 : std::stoi(nthStr);
         
         int userPos = findUser(username);
-        if (userPos == -1 || !loggedIn[userPos]) {
-            std::cout << "-1\n";
+        if (userPos == -1 || !loggedIn[userPos] || nth < 1) {
+            reply() << "-1\n";
+            return;
+        }
+        
+        std::lock_guard<std::mutex> userGuard(userLock(userPos));
+        int id = newestOrder(userPos);
+        Order order;
+        for (int i = 0; id != -1; i++) {
+            orders.read(id, order);
+            if (i == nth - 1) break;
+            id = order.userPrev;
+        }
+        if (id == -1) {
+            reply() << "-1\n";
             return;
         }
         
-        std::cout << "-1\n";
+        Train train;
+        loadTrain(order.trainPos, train);
+        bool seatsChanged = false;
+        {
+            std::lock_guard<std::mutex> runGuard(runLock(order.trainPos, order.startDay));
+            // The status may have moved from pending to success since it was read
+            char status = orderStatus(id);
+            if (status == ORDER_REFUNDED) {
+                reply() << "-1\n";
+                return;
+            }
+            VersionStore::Transaction txn(versions);
+            setOrderStatus(txn, id, ORDER_REFUNDED);
+            if (status == ORDER_SUCCESS) {
+                int block[101];
+                long long offset = runOffset(train, order.startDay);
+                seats.read(offset, block, runInts(train) * sizeof(int));
+                saveRun(txn, offset, block, train);
+                for (int i = order.fromIdx; i < order.toIdx; i++) block[2 + i] += order.num;
+                fillStandby(txn, block);
+                seats.write(offset, block, runInts(train) * sizeof(int));
+                seatsChanged = true;
+            }
+        }
+        if (seatsChanged) invalidateRun(order.trainPos, order.startDay);
+        reply() << "0\n";
     }
     
     void handleClean() {
         users.clear();
         trains.clear();
+        trainHeap.clear();
+        seats.clear();
+        orders.clear();
+        userOrders.clear();
+        userFilter.clear();
+        trainFilter.clear();
+        userIndex.clear();
+        trainIndex.clear();
+        queryCache.clear();
+        planner.clear();
         memset(loggedIn, 0, sizeof(loggedIn));
-        memset(trainPositions, -1, sizeof(trainPositions));
-        userCount = 0;
-        trainCount = 0;
-        std::cout << "0\n";
+        resetCatalog();
+        routesLoaded = true;
+        reply() << "0\n";
     }
     
     void handleExit() {
         memset(loggedIn, 0, sizeof(loggedIn));
-        std::cout << "bye\n";
+        pager.flush();
+        reportMemory();
+        reply() << "bye\n";
         exit(0);
     }
 };
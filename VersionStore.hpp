@@ -0,0 +1,199 @@
+#ifndef VERSIONSTORE_HPP
+#define VERSIONSTORE_HPP
+
+#include <cstring>
+#include <climits>
+#include <new>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include "MemoryGovernor.hpp"
+
+// Old versions of records that readers see through snapshots.
+//
+// The newest value of a record stays where it always was, behind the
+// pager. Before a writer changes a record it saves the old bytes here, and
+// its commit stamps everything it saved with one timestamp from the commit
+// clock. A reader takes a snapshot of the clock, reads the current bytes,
+// then swaps in the oldest saved version stamped after its snapshot, if
+// there is one. Writes to one record must be serialized by the caller and
+// committed before the next writer of that record starts. Versions are
+// freed in commit order once every open snapshot is at least as new.
+class VersionStore : public MemoryConsumer {
+private:
+    static const int BUCKETS = 4096;  // Power of two
+    static const int LATCHES = 64;
+    static const int MAX_SNAPSHOTS = 64;
+    static const long long PENDING = LLONG_MAX;  // Stamp of an uncommitted version
+    static const long long NO_SNAPSHOT = -1;
+
+    struct Version {
+        long long key;
+        std::atomic<long long> validTo;  // Commit that replaced these bytes
+        Version* newer;
+        Version* older;
+        Version* nextSaved;  // Writer's list, then the reclaim queue
+        int length;
+
+        char* image() { return reinterpret_cast<char*>(this + 1); }
+    };
+
+    Version* buckets[BUCKETS];  // Newest first
+    std::mutex latches[LATCHES];
+
+    // Guards the clock, snapshot slots and reclaim queue
+    std::mutex commitMutex;
+    long long clock;
+    long long snapshots[MAX_SNAPSHOTS];
+    Version* oldest;
+    Version* newest;
+
+    std::atomic<long long> bytes;
+    std::atomic<long long> versionCount;
+
+    static int bucketOf(long long key) {
+        unsigned long long h = (unsigned long long)key * 0x9E3779B97F4A7C15ULL;
+        return (int)(h >> 52) & (BUCKETS - 1);
+    }
+
+    std::mutex& latchOf(int bucket) { return latches[bucket % LATCHES]; }
+
+    // Caller holds commitMutex
+    void reclaim() {
+        long long horizon = clock;
+        for (int i = 0; i < MAX_SNAPSHOTS; i++) {
+            if (snapshots[i] != NO_SNAPSHOT && snapshots[i] < horizon) horizon = snapshots[i];
+        }
+        while (oldest && oldest->validTo.load() <= horizon) {
+            Version* v = oldest;
+            oldest = v->nextSaved;
+            if (!oldest) newest = nullptr;
+            int bucket = bucketOf(v->key);
+            {
+                std::lock_guard<std::mutex> guard(latchOf(bucket));
+                if (v->newer) v->newer->older = v->older;
+                else buckets[bucket] = v->older;
+                if (v->older) v->older->newer = v->newer;
+            }
+            bytes -= sizeof(Version) + v->length;
+            versionCount--;
+            v->~Version();
+            ::operator delete(v);
+        }
+    }
+
+public:
+    VersionStore() : clock(0), oldest(nullptr), newest(nullptr), bytes(0), versionCount(0) {
+        for (int i = 0; i < BUCKETS; i++) buckets[i] = nullptr;
+        for (int i = 0; i < MAX_SNAPSHOTS; i++) snapshots[i] = NO_SNAPSHOT;
+    }
+
+    ~VersionStore() {
+        // No snapshot outlives the store, so everything committed goes
+        for (int i = 0; i < MAX_SNAPSHOTS; i++) snapshots[i] = NO_SNAPSHOT;
+        reclaim();
+    }
+
+    long long memoryUsage() const override { return sizeof(VersionStore) + bytes.load(); }
+
+    long long size() const { return versionCount.load(); }
+
+    // Everything one writer changes becomes visible at once
+    class Transaction {
+    private:
+        VersionStore& store;
+        Version* saved;
+
+    public:
+        explicit Transaction(VersionStore& versionStore) : store(versionStore), saved(nullptr) {}
+
+        ~Transaction() { commit(); }
+
+        // Records the bytes of key before its first change in this transaction
+        void save(long long key, const void* before, int length) {
+            for (Version* v = saved; v; v = v->nextSaved) {
+                if (v->key == key) return;
+            }
+            void* raw = ::operator new(sizeof(Version) + length);
+            Version* v = new (raw) Version();
+            v->key = key;
+            v->validTo.store(PENDING);
+            v->length = length;
+            memcpy(v->image(), before, length);
+            v->nextSaved = saved;
+            saved = v;
+            store.bytes += sizeof(Version) + length;
+            store.versionCount++;
+
+            int bucket = bucketOf(key);
+            std::lock_guard<std::mutex> guard(store.latchOf(bucket));
+            v->newer = nullptr;
+            v->older = store.buckets[bucket];
+            if (v->older) v->older->newer = v;
+            store.buckets[bucket] = v;
+        }
+
+        void commit() {
+            if (!saved) return;
+            std::lock_guard<std::mutex> guard(store.commitMutex);
+            long long stamp = ++store.clock;
+            Version* last = saved;
+            for (Version* v = saved; v; v = v->nextSaved) {
+                v->validTo.store(stamp);
+                last = v;
+            }
+            if (store.newest) store.newest->nextSaved = saved;
+            else store.oldest = saved;
+            store.newest = last;
+            saved = nullptr;
+            store.reclaim();
+        }
+    };
+
+    // A point-in-time view; every commit after it stays invisible
+    class Snapshot {
+    private:
+        VersionStore& store;
+        int slot;
+        long long stamp;
+
+    public:
+        explicit Snapshot(VersionStore& versionStore) : store(versionStore), slot(-1), stamp(0) {
+            while (true) {
+                {
+                    std::lock_guard<std::mutex> guard(store.commitMutex);
+                    for (int i = 0; i < MAX_SNAPSHOTS; i++) {
+                        if (store.snapshots[i] == NO_SNAPSHOT) {
+                            slot = i;
+                            stamp = store.snapshots[i] = store.clock;
+                            return;
+                        }
+                    }
+                }
+                std::this_thread::yield();
+            }
+        }
+
+        ~Snapshot() {
+            std::lock_guard<std::mutex> guard(store.commitMutex);
+            store.snapshots[slot] = NO_SNAPSHOT;
+            store.reclaim();
+        }
+
+        // Turns the current bytes of key, already read, into its bytes as of the snapshot
+        void read(long long key, void* current, int length) const {
+            int bucket = bucketOf(key);
+            std::lock_guard<std::mutex> guard(store.latchOf(bucket));
+            Version* match = nullptr;
+            for (Version* v = store.buckets[bucket]; v; v = v->older) {
+                if (v->key != key) continue;
+                // Pending versions commit after the snapshot was taken
+                if (v->validTo.load() <= stamp) break;
+                match = v;
+            }
+            if (match) memcpy(current, match->image(), length < match->length ? length : match->length);
+        }
+    };
+};
+
+#endif
@@ -0,0 +1,172 @@
+#ifndef WORKERPOOL_HPP
+#define WORKERPOOL_HPP
+
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+// Small work-stealing pool for data-parallel loops over an index range.
+//
+// run(count, func) calls func(index, worker) once for every index in
+// [0, count). Each worker starts with an equal slice of the range, packed
+// as (begin, end) into one atomic word. The owner takes grain-sized chunks
+// from the front; an idle worker steals the back half of another slice.
+// The calling thread takes part as worker 0, and the other threads start
+// on the first loop large enough to be split. A loop started while another
+// caller owns the pool runs inline.
+class WorkerPool {
+public:
+    static const int MAX_WORKERS = 16;
+
+private:
+    typedef void (*Task)(void* context, int index, int worker);
+
+    struct Slice {
+        std::atomic<uint64_t> bounds;
+        char pad[64 - sizeof(std::atomic<uint64_t>)];  // One slice per cache line
+    };
+
+    int workerCount;
+    bool started;
+    std::thread threads[MAX_WORKERS];
+    Slice slices[MAX_WORKERS];
+
+    std::mutex owner;  // Held by the caller whose loop the workers run
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    Task task;
+    void* context;
+    int grain;
+    int generation;
+    int active;
+    bool stopping;
+
+    static uint64_t pack(uint32_t begin, uint32_t end) { return (uint64_t)begin << 32 | end; }
+
+    bool take(int w, uint32_t& begin, uint32_t& end) {
+        uint64_t cur = slices[w].bounds.load();
+        while (true) {
+            uint32_t b = (uint32_t)(cur >> 32), e = (uint32_t)cur;
+            if (b >= e) return false;
+            uint32_t next = e - b > (uint32_t)grain ? b + grain : e;
+            if (slices[w].bounds.compare_exchange_weak(cur, pack(next, e))) {
+                begin = b;
+                end = next;
+                return true;
+            }
+        }
+    }
+
+    // Moves the back half of a victim's slice into worker w's empty slice
+    bool steal(int w) {
+        for (int i = 1; i < workerCount; i++) {
+            int victim = (w + i) % workerCount;
+            uint64_t cur = slices[victim].bounds.load();
+            while (true) {
+                uint32_t b = (uint32_t)(cur >> 32), e = (uint32_t)cur;
+                if (b >= e) break;
+                uint32_t mid = b + (e - b) / 2;
+                if (slices[victim].bounds.compare_exchange_weak(cur, pack(b, mid))) {
+                    slices[w].bounds.store(pack(mid, e));
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void drain(int w) {
+        uint32_t begin, end;
+        while (true) {
+            if (!take(w, begin, end)) {
+                if (!steal(w)) return;
+                continue;
+            }
+            for (uint32_t i = begin; i < end; i++) task(context, (int)i, w);
+        }
+    }
+
+    void workerLoop(int w) {
+        int seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+            lock.unlock();
+            drain(w);
+            lock.lock();
+            if (--active == 0) done.notify_one();
+        }
+    }
+
+    template<typename Func>
+    static void call(void* func, int index, int worker) {
+        (*static_cast<Func*>(func))(index, worker);
+    }
+
+public:
+    // workers <= 0 uses one worker per hardware thread
+    explicit WorkerPool(int workers = 0)
+        : started(false), task(nullptr), context(nullptr), grain(1), generation(0), active(0), stopping(false) {
+        setWorkerCount(workers);
+        for (int w = 0; w < MAX_WORKERS; w++) slices[w].bounds.store(0);
+    }
+
+    ~WorkerPool() {
+        if (!started) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (int w = 1; w < workerCount; w++) threads[w].join();
+    }
+
+    int size() const { return workerCount; }
+
+    // Has no effect once the threads have started
+    void setWorkerCount(int workers) {
+        if (started) return;
+        if (workers <= 0) workers = (int)std::thread::hardware_concurrency();
+        if (workers < 1) workers = 1;
+        if (workers > MAX_WORKERS) workers = MAX_WORKERS;
+        workerCount = workers;
+    }
+
+    // Loops of fewer than minParallel indices run inline on the caller
+    template<typename Func>
+    void run(int count, Func& func, int chunk = 16, int minParallel = 64) {
+        std::unique_lock<std::mutex> owned(owner, std::defer_lock);
+        if (workerCount == 1 || count < minParallel || !owned.try_lock()) {
+            for (int i = 0; i < count; i++) func(i, 0);
+            return;
+        }
+        if (!started) {
+            started = true;
+            for (int w = 1; w < workerCount; w++) threads[w] = std::thread(&WorkerPool::workerLoop, this, w);
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        for (int w = 0; w < workerCount; w++) {
+            slices[w].bounds.store(pack((uint32_t)((long long)count * w / workerCount),
+                                        (uint32_t)((long long)count * (w + 1) / workerCount)));
+        }
+        task = &WorkerPool::call<Func>;
+        context = &func;
+        grain = chunk > 0 ? chunk : 1;
+        active = workerCount - 1;
+        generation++;
+        lock.unlock();
+        wake.notify_all();
+
+        drain(0);
+        lock.lock();
+        done.wait(lock, [this] { return active == 0; });
+    }
+};
+
+#endif
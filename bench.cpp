@@ -0,0 +1,355 @@
+// Microbenchmarks for the core data structures.
+//
+// Usage: ./bench [--max=N] [--sort-max=N]
+//
+// Runs each structure at 10^4, 10^5 and 10^6 elements (up to --max) and
+// prints one JSON object per measurement:
+//   {"structure": ..., "op": ..., "n": ..., "cache": ..., "seconds": ...,
+//    "ops_per_sec": ..., "disk_read": ..., "disk_written": ...}
+// "cache" is "warm" when the buffer pool already holds the data, "cold"
+// after the pager was reopened and the file dropped from the OS page cache,
+// "direct" for the same cold start with the pager in O_DIRECT mode, and
+// "memory" for in-memory structures. A measurement meant to be warm that
+// still read from the file, because the data outgrew the pool, is reported
+// as "partial". Disk bytes are what the pager moved with pread/pwrite
+// during the measurement.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include "TicketSystem.hpp"
+#include "BPlusTree.hpp"
+
+static const char* BENCH_DB = "bench.db";
+static const int PERMUTE = 7919;  // Prime, so i * PERMUTE % n permutes 10^k
+
+static volatile long long sink;  // Keeps results observable
+
+struct Measurement {
+    const char* structure;
+    const char* op;
+    int n;
+    const char* cache;
+    const Pager* pager;
+    long long readBefore, writtenBefore;
+    std::chrono::steady_clock::time_point start;
+
+    Measurement(const char* s, const char* o, int count, const char* c, const Pager* p)
+        : structure(s), op(o), n(count), cache(c), pager(p) {
+        readBefore = pager ? pager->diskBytesRead() : 0;
+        writtenBefore = pager ? pager->diskBytesWritten() : 0;
+        start = std::chrono::steady_clock::now();
+    }
+
+    void finish() {
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        long long read = pager ? pager->diskBytesRead() - readBefore : 0;
+        long long written = pager ? pager->diskBytesWritten() - writtenBefore : 0;
+        const char* label = read > 0 && strcmp(cache, "warm") == 0 ? "partial" : cache;
+        printf("{\"structure\": \"%s\", \"op\": \"%s\", \"n\": %d, \"cache\": \"%s\", \"seconds\": %.6f, "
+               "\"ops_per_sec\": %.0f, \"disk_read\": %lld, \"disk_written\": %lld}\n",
+               structure, op, n, label, seconds, seconds > 0 ? n / seconds : 0.0, read, written);
+        fflush(stdout);
+    }
+};
+
+static UserName keyOf(int i) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), "user%08d", i);
+    return UserName(buf);
+}
+
+// Writes the file back and drops it from the OS page cache
+static void dropOsCache() {
+    int fd = open(BENCH_DB, O_RDONLY);
+    if (fd == -1) return;
+    fsync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+static void benchBPlusTree(int n) {
+    unlink(BENCH_DB);
+    {
+        Pager pager(BENCH_DB);
+        BPlusTree<UserName, int> tree(pager, "tree");
+        Measurement insert("bplustree", "insert", n, "warm", &pager);
+        for (int i = 0; i < n; i++) tree.insert(keyOf((long long)i * PERMUTE % n), i);
+        pager.flush();
+        insert.finish();
+
+        Measurement find("bplustree", "find", n, "warm", &pager);
+        long long found = 0;
+        for (int i = 0; i < n; i++) {
+            int value;
+            found += tree.find(keyOf((long long)i * PERMUTE % n), value);
+        }
+        sink = found;
+        find.finish();
+    }
+    dropOsCache();
+    {
+        Pager pager(BENCH_DB);
+        BPlusTree<UserName, int> tree(pager, "tree");
+        Measurement find("bplustree", "find", n, "cold", &pager);
+        long long found = 0;
+        for (int i = 0; i < n; i++) {
+            int value;
+            found += tree.find(keyOf((long long)i * PERMUTE % n), value);
+        }
+        sink = found;
+        find.finish();
+
+        Measurement scan("bplustree", "scan", n, "warm", &pager);
+        long long sum = 0;
+        tree.traverse([&](const UserName&, int value) { sum += value; });
+        sink = sum;
+        scan.finish();
+    }
+    dropOsCache();
+    {
+        Pager pager(BENCH_DB);
+        if (pager.useDirectIo()) {
+            BPlusTree<UserName, int> tree(pager, "tree");
+            Measurement find("bplustree", "find", n, "direct", &pager);
+            long long found = 0;
+            for (int i = 0; i < n; i++) {
+                int value;
+                found += tree.find(keyOf((long long)i * PERMUTE % n), value);
+            }
+            sink = found;
+            find.finish();
+        }
+    }
+    unlink(BENCH_DB);
+}
+
+static void benchFileStorage(int n) {
+    unlink(BENCH_DB);
+    User user;
+    {
+        Pager pager(BENCH_DB);
+        FileStorage<User> storage(pager, "users");
+        Measurement write("filestorage", "write", n, "warm", &pager);
+        for (int i = 0; i < n; i++) {
+            user.username = keyOf(i);
+            user.privilege = i % 11;
+            user.exists = true;
+            storage.write(i, user);
+        }
+        pager.flush();
+        write.finish();
+
+        Measurement read("filestorage", "read", n, "warm", &pager);
+        long long sum = 0;
+        for (int i = 0; i < n; i++) {
+            storage.read((long long)i * PERMUTE % n, user);
+            sum += user.privilege;
+        }
+        sink = sum;
+        read.finish();
+    }
+    dropOsCache();
+    {
+        Pager pager(BENCH_DB);
+        FileStorage<User> storage(pager, "users");
+        Measurement read("filestorage", "read", n, "cold", &pager);
+        long long sum = 0;
+        for (int i = 0; i < n; i++) {
+            storage.read((long long)i * PERMUTE % n, user);
+            sum += user.privilege;
+        }
+        sink = sum;
+        read.finish();
+
+        Measurement scan("filestorage", "scan", n, "warm", &pager);
+        sum = 0;
+        for (int i = 0; i < n; i++) {
+            storage.read(i, user);
+            sum += user.privilege;
+        }
+        sink = sum;
+        scan.finish();
+    }
+    dropOsCache();
+    {
+        Pager pager(BENCH_DB);
+        if (pager.useDirectIo()) {
+            FileStorage<User> storage(pager, "users");
+            Measurement read("filestorage", "read", n, "direct", &pager);
+            long long sum = 0;
+            for (int i = 0; i < n; i++) {
+                storage.read((long long)i * PERMUTE % n, user);
+                sum += user.privilege;
+            }
+            sink = sum;
+            read.finish();
+        }
+    }
+    unlink(BENCH_DB);
+}
+
+static void benchExtendibleHash(int n) {
+    unlink(BENCH_DB);
+    {
+        Pager pager(BENCH_DB);
+        ExtendibleHash<UserName> index(pager, "index");
+        Measurement insert("extendiblehash", "insert", n, "warm", &pager);
+        for (int i = 0; i < n; i++) index.insert(keyOf((long long)i * PERMUTE % n), i);
+        pager.flush();
+        insert.finish();
+
+        Measurement find("extendiblehash", "find", n, "warm", &pager);
+        long long found = 0;
+        for (int i = 0; i < n; i++) {
+            int value;
+            found += index.find(keyOf(i), value);
+        }
+        sink = found;
+        find.finish();
+    }
+    dropOsCache();
+    {
+        Pager pager(BENCH_DB);
+        ExtendibleHash<UserName> index(pager, "index");
+        Measurement find("extendiblehash", "find", n, "cold", &pager);
+        long long found = 0;
+        for (int i = 0; i < n; i++) {
+            int value;
+            found += index.find(keyOf((long long)i * PERMUTE % n), value);
+        }
+        sink = found;
+        find.finish();
+
+        Measurement miss("extendiblehash", "find_miss", n, "warm", &pager);
+        found = 0;
+        for (int i = 0; i < n; i++) {
+            int value;
+            found += index.find(keyOf(n + i), value);
+        }
+        sink = found;
+        miss.finish();
+    }
+    unlink(BENCH_DB);
+}
+
+// Records of 64 to 1023 bytes; the second half of the erase-reinsert pass
+// should fill the space the first half freed
+static void benchHeapFile(int n) {
+    unlink(BENCH_DB);
+    char record[1024];
+    memset(record, 'x', sizeof(record));
+    long long* rids = new long long[n];
+    {
+        Pager pager(BENCH_DB);
+        HeapFile heap(pager, "heap");
+        Measurement insert("heapfile", "insert", n, "warm", &pager);
+        for (int i = 0; i < n; i++) rids[i] = heap.insert(record, 64 + i % 960);
+        pager.flush();
+        insert.finish();
+
+        Measurement read("heapfile", "read", n, "warm", &pager);
+        long long sum = 0;
+        for (int i = 0; i < n; i++) sum += heap.read(rids[(long long)i * PERMUTE % n], record);
+        sink = sum;
+        read.finish();
+
+        Measurement reuse("heapfile", "erase_reinsert", n, "warm", &pager);
+        for (int i = 0; i < n; i += 2) heap.erase(rids[i]);
+        for (int i = 0; i < n; i += 2) rids[i] = heap.insert(record, 64 + (i + 1) % 960);
+        pager.flush();
+        reuse.finish();
+    }
+    dropOsCache();
+    {
+        Pager pager(BENCH_DB);
+        HeapFile heap(pager, "heap");
+        Measurement read("heapfile", "read", n, "cold", &pager);
+        long long sum = 0;
+        for (int i = 0; i < n; i++) sum += heap.read(rids[(long long)i * PERMUTE % n], record);
+        sink = sum;
+        read.finish();
+    }
+    delete[] rids;
+    unlink(BENCH_DB);
+}
+
+// Table size is a template argument, so each n needs its own instantiation
+template<int SIZE>
+static void benchHashMap(int n) {
+    HashMap<UserName, int, SIZE>* map = new HashMap<UserName, int, SIZE>();
+    Measurement insert("hashmap", "insert", n, "memory", nullptr);
+    for (int i = 0; i < n; i++) map->insert(keyOf((long long)i * PERMUTE % n), i);
+    insert.finish();
+
+    Measurement hit("hashmap", "find_hit", n, "memory", nullptr);
+    long long found = 0;
+    for (int i = 0; i < n; i++) {
+        int value;
+        found += map->find(keyOf(i), value);
+    }
+    sink = found;
+    hit.finish();
+
+    Measurement miss("hashmap", "find_miss", n, "memory", nullptr);
+    found = 0;
+    for (int i = 0; i < n; i++) {
+        int value;
+        found += map->find(keyOf(n + i), value);
+    }
+    sink = found;
+    miss.finish();
+    delete map;
+}
+
+static void benchVector(int n) {
+    Vector<int> vec;
+    Measurement push("vector", "push_back", n, "memory", nullptr);
+    for (int i = 0; i < n; i++) vec.push_back(i);
+    push.finish();
+
+    Measurement scan("vector", "scan", n, "memory", nullptr);
+    long long sum = 0;
+    for (int i = 0; i < vec.size(); i++) sum += vec[i];
+    sink = sum;
+    scan.finish();
+
+    Measurement random("vector", "random_read", n, "memory", nullptr);
+    sum = 0;
+    for (int i = 0; i < n; i++) sum += vec[(long long)i * PERMUTE % n];
+    sink = sum;
+    random.finish();
+}
+
+static void benchArraySort(int n) {
+    Array<int> array;
+    for (int i = 0; i < n; i++) array.add((int)((long long)i * PERMUTE % n));
+    Measurement sort("array", "sort", n, "memory", nullptr);
+    array.sort([](int a, int b) { return a < b; });
+    sort.finish();
+    sink = array[0];
+}
+
+int main(int argc, char* argv[]) {
+    int maxN = 1000000;
+    int sortMax = 10000;  // Array::sort is quadratic
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--max=", 6) == 0) maxN = atoi(argv[i] + 6);
+        if (strncmp(argv[i], "--sort-max=", 11) == 0) sortMax = atoi(argv[i] + 11);
+    }
+
+    for (int n = 10000; n <= maxN; n *= 10) {
+        benchBPlusTree(n);
+        benchFileStorage(n);
+        benchExtendibleHash(n);
+        benchHeapFile(n);
+        if (n == 10000) benchHashMap<20011>(n);
+        else if (n == 100000) benchHashMap<200003>(n);
+        else if (n == 1000000) benchHashMap<2000003>(n);
+        benchVector(n);
+        if (n <= sortMax) benchArraySort(n);
+    }
+    return 0;
+}
@@ -0,0 +1,70 @@
+// Test client for server mode.
+//
+// Usage: ./client SOCKET_PATH < commands
+//
+// Sends stdin to the server and prints every reply until the server closes
+// the session (after "exit" or once all input has been answered).
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s SOCKET_PATH\n", argv[0]);
+        return 1;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(argv[1]) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "socket path too long\n");
+        return 1;
+    }
+    strcpy(addr.sun_path, argv[1]);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        perror("connect");
+        return 1;
+    }
+
+    // Forward stdin and print replies at the same time, so neither side can
+    // fill its socket buffer and stall the other
+    static char buf[1 << 16];
+    bool inputOpen = true;
+    while (true) {
+        struct pollfd fds[2];
+        fds[0].fd = fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = 0;
+        fds[1].events = POLLIN;
+        if (poll(fds, inputOpen ? 2 : 1, -1) == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        if (fds[0].revents) {
+            ssize_t n = read(fd, buf, sizeof(buf));
+            if (n <= 0) break;
+            fwrite(buf, 1, n, stdout);
+        }
+        if (inputOpen && fds[1].revents) {
+            ssize_t n = read(0, buf, sizeof(buf));
+            if (n <= 0) {
+                shutdown(fd, SHUT_WR);
+                inputOpen = false;
+                continue;
+            }
+            for (ssize_t sent = 0; sent < n;) {
+                ssize_t m = write(fd, buf + sent, n - sent);
+                if (m <= 0) return 1;
+                sent += m;
+            }
+        }
+    }
+    close(fd);
+    return 0;
+}
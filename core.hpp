@@ -3,12 +3,14 @@
 
 #include <cstring>
 #include <cstdio>
+#include "FixedString.hpp"
 
 // Maximum sizes
 const int MAX_USERS = 20000;
 const int MAX_TRAINS = 5000;
 const int MAX_ORDERS = 100000;
 const int MAX_DATES = 92;  // June-August
+const int MAX_ROUTE_TRANSFERS = 5;
 
 // Simple pair template
 template<typename T1, typename T2>
@@ -52,7 +54,9 @@ public:
     const T& operator[](int i) const { return data[i]; }
     
     int size() const { return len; }
+    int capacity() const { return cap; }
     void clear() { len = 0; }
+    void truncate(int n) { if (n < len) len = n; }
     
     // Sort using simple bubble sort (sufficient for small arrays)
     template<typename Comp>
@@ -69,6 +73,52 @@ public:
     }
 };
 
+// LEB128 unsigned varints: 7 bits per byte, high bit set on all but the last
+inline int writeVarint(unsigned char* buf, unsigned int value) {
+    int n = 0;
+    while (value >= 0x80) {
+        buf[n++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    buf[n++] = (unsigned char)value;
+    return n;
+}
+
+inline int readVarint(const unsigned char* buf, unsigned int& value) {
+    int n = 0;
+    int shift = 0;
+    value = 0;
+    while (buf[n] & 0x80) {
+        value |= (unsigned int)(buf[n++] & 0x7F) << shift;
+        shift += 7;
+    }
+    value |= (unsigned int)buf[n++] << shift;
+    return n;
+}
+
+// Key hashing and equality used by HashMap
+inline unsigned int hashKey(const char* str) {
+    unsigned int h = 0;
+    while (*str) {
+        h = h * 131 + *str++;
+    }
+    return h;
+}
+
+template<int N>
+inline unsigned int hashKey(const FixedString<N>& key) {
+    return key.hash();
+}
+
+inline bool keyEquals(const char* a, const char* b) {
+    return strcmp(a, b) == 0;
+}
+
+template<typename K>
+inline bool keyEquals(const K& a, const K& b) {
+    return a == b;
+}
+
 // Simple hash map using linear probing
 template<typename K, typename V, int SIZE = 10007>
 class HashMap {
@@ -83,12 +133,8 @@ private:
     
     Entry table[SIZE];
     
-    unsigned int hash(const char* str) {
-        unsigned int h = 0;
-        while (*str) {
-            h = h * 131 + *str++;
-        }
-        return h % SIZE;
+    unsigned int hash(const K& key) {
+        return hashKey(key) % SIZE;
     }
     
 public:
@@ -102,7 +148,7 @@ public:
                 table[pos].used = true;
                 return;
             }
-            if (strcmp(table[pos].key, key) == 0) {
+            if (keyEquals(table[pos].key, key)) {
                 table[pos].value = value;
                 return;
             }
@@ -116,7 +162,7 @@ public:
             if (!table[pos].used) {
                 return false;
             }
-            if (strcmp(table[pos].key, key) == 0) {
+            if (keyEquals(table[pos].key, key)) {
                 value = table[pos].value;
                 return true;
             }
@@ -1,18 +1,77 @@
 #include <iostream>
 #include <cstring>
+#include <cstdlib>
 #include <fstream>
 #include "TicketSystem.hpp"
+#include "Server.hpp"
+#include "ShardExecutor.hpp"
 
-int main() {
+int main(int argc, char* argv[]) {
     std::ios::sync_with_stdio(false);
     std::cin.tie(nullptr);
     
     TicketSystem system;
-    std::string line;
+    const char* socketPath = nullptr;
+    int shards = 1;
+    for (int i = 1; i < argc; i++) {
+        // --write-back[=pages]: flush dirty pages from a background thread
+        if (strncmp(argv[i], "--write-back", 12) == 0) {
+            system.enableWriteBack(argv[i][12] == '=' ? atoi(argv[i] + 13) : 0);
+        }
+        // --io-uring: submit batched page reads and writes through io_uring when the kernel allows it
+        if (strcmp(argv[i], "--io-uring") == 0) {
+            system.enableIoRing();
+        }
+        // --direct-io: open the database with O_DIRECT, so only the pager caches pages
+        if (strcmp(argv[i], "--direct-io") == 0) {
+            system.enableDirectIo();
+        }
+        // --workers=N: threads for large query fan-outs (default: one per core)
+        if (strncmp(argv[i], "--workers=", 10) == 0) {
+            system.setWorkers(atoi(argv[i] + 10));
+        }
+        // --memory-limit=MiB: budget shared by all caches
+        if (strncmp(argv[i], "--memory-limit=", 15) == 0) {
+            system.setMemoryLimit(atoll(argv[i] + 15) * MEBIBYTE);
+        }
+        // --memory-report: print per-cache usage to stderr on exit
+        if (strcmp(argv[i], "--memory-report") == 0) {
+            system.enableMemoryReport();
+        }
+        // --shards=N: run single-train commands on N threads partitioned by train
+        if (strncmp(argv[i], "--shards=", 9) == 0) {
+            shards = atoi(argv[i] + 9);
+        }
+        // --server=PATH: serve clients on a Unix domain socket instead of stdin
+        if (strncmp(argv[i], "--server=", 9) == 0) {
+            socketPath = argv[i] + 9;
+        }
+    }
+    
+    if (socketPath) {
+        Server server(system, socketPath);
+        if (!server.run()) {
+            std::cerr << "cannot listen on " << socketPath << "\n";
+            return 1;
+        }
+        system.reportMemory();
+        return 0;
+    }
     
-    while (std::getline(std::cin, line)) {
-        system.processCommand(line);
+    // Input is read and tokenized on its own thread
+    CommandReader reader;
+    system.accountMemory("input", CommandReader::memoryUsage());
+    if (shards > 1) {
+        ShardExecutor executor(system, shards);
+        system.accountMemory("shards", executor.memoryUsage());
+        executor.run(reader);
+    } else {
+        while (Command* command = reader.next()) {
+            system.processCommand(*command);
+            reader.release();
+        }
     }
+    system.reportMemory();
     
     return 0;
 }
@@ -0,0 +1,221 @@
+// Multi-threaded booking stress test.
+//
+// Usage: ./stress [--shards=N] [--threads=N] [--rounds=N]
+//
+// Releases TRAINS trains over the same four stations, each running on two
+// days, then books them in two phases:
+//   1. A generated stream of buy_ticket/refund_ticket, with query_ticket
+//      mixed in, runs through ShardExecutor with --shards shard threads.
+//   2. --threads threads call processCommand directly, so bookings on the
+//      same (train, day) race for its run lock, while another thread keeps
+//      query_ticket fanning out over the worker pool.
+// Most bookings go to two hot trains so runs sell out and queue; the rest
+// spread over every (train, day). After each phase, every segment of every
+// run must have remaining seats >= 0, and the seats sold by [success]
+// orders plus the remaining seats must equal seatNum. Prints OK, or each
+// mismatch; exits with 1 on failure. Works on its own stress.db, which is
+// removed at the end.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <unistd.h>
+#include "TicketSystem.hpp"
+#include "ShardExecutor.hpp"
+
+static const int TRAINS = 64;  // Enough candidates for query_ticket to fan out
+static const int DAYS = 2;
+static const int SEGMENTS = 3;
+static const int SEATS = 100;
+static const int USERS = 256;
+static const char* STRESS_DB = "stress.db";  // Never the real ticket.db
+static const char* STATIONS[SEGMENTS + 1] = {"A", "B", "C", "D"};
+
+// Deterministic per-thread generator
+struct Lcg {
+    unsigned long long state;
+    explicit Lcg(unsigned long long seed) : state(seed * 2862933555777941757ULL + 3037000493ULL) {}
+    int next(int bound) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        return (int)((state >> 33) % (unsigned long long)bound);
+    }
+};
+
+// A random booking command by user u
+static void bookingCommand(Lcg& lcg, int u, char* buf, int size) {
+    if (lcg.next(3) == 0) {
+        snprintf(buf, size, "refund_ticket -u u%d -n %d", u, 1 + lcg.next(3));
+        return;
+    }
+    int train = lcg.next(4) != 0 ? lcg.next(2) : lcg.next(TRAINS);
+    int from = lcg.next(SEGMENTS);
+    int to = from + 1 + lcg.next(SEGMENTS - from);
+    snprintf(buf, size, "buy_ticket -u u%d -i K%d -d 06-0%d -n %d -f %s -t %s -q %s", u, train,
+             1 + lcg.next(DAYS), 1 + lcg.next(8), STATIONS[from], STATIONS[to], lcg.next(2) ? "true" : "false");
+}
+
+static std::string run(TicketSystem& system, const char* line) {
+    std::ostringstream out;
+    TicketSystem::setReplyStream(&out);
+    system.processCommand(line);
+    TicketSystem::setReplyStream(nullptr);
+    return out.str();
+}
+
+static void setup(TicketSystem& system) {
+    char buf[256];
+    run(system, "add_user -c x -u u0 -p password -n name -m u@x -g 10");
+    run(system, "login -u u0 -p password");
+    for (int u = 1; u < USERS; u++) {
+        snprintf(buf, sizeof(buf), "add_user -c u0 -u u%d -p password -n name -m u@x -g 1", u);
+        run(system, buf);
+        snprintf(buf, sizeof(buf), "login -u u%d -p password", u);
+        run(system, buf);
+    }
+    for (int k = 0; k < TRAINS; k++) {
+        snprintf(buf, sizeof(buf),
+                 "add_train -i K%d -n 4 -m %d -s A|B|C|D -p 1|1|1 -x 06:00 -t 10|10|10 -o 5|5 -d 06-01|06-02 -y G",
+                 k, SEATS);
+        run(system, buf);
+        snprintf(buf, sizeof(buf), "release_train -i K%d", k);
+        run(system, buf);
+    }
+}
+
+// Checks every run against the orders; returns the number of mismatches
+static int check(TicketSystem& system, const char* phase) {
+    static int sold[TRAINS][DAYS][SEGMENTS];
+    memset(sold, 0, sizeof(sold));
+    char buf[256];
+    for (int u = 0; u < USERS; u++) {
+        snprintf(buf, sizeof(buf), "query_order -u u%d", u);
+        std::istringstream in(run(system, buf));
+        std::string line;
+        std::getline(in, line);
+        while (std::getline(in, line)) {
+            if (line.compare(0, 9, "[success]") != 0) continue;
+            int train, day, price, num;
+            char from, to;
+            sscanf(line.c_str(), "[success] K%d %c 06-%d %*s -> %c %*s %*s %d %d", &train, &from, &day, &to, &price,
+                   &num);
+            for (int s = from - 'A'; s < to - 'A'; s++) sold[train][day - 1][s] += num;
+        }
+    }
+
+    int failures = 0;
+    for (int k = 0; k < TRAINS; k++) {
+        for (int d = 0; d < DAYS; d++) {
+            snprintf(buf, sizeof(buf), "query_train -i K%d -d 06-0%d", k, d + 1);
+            std::istringstream in(run(system, buf));
+            std::string line;
+            std::getline(in, line);
+            for (int s = 0; s < SEGMENTS && std::getline(in, line); s++) {
+                int left = atoi(line.c_str() + line.rfind(' ') + 1);
+                if (left >= 0 && left + sold[k][d][s] == SEATS) continue;
+                printf("%s: K%d 06-0%d %s->%s remaining %d sold %d seatNum %d\n", phase, k, d + 1, STATIONS[s],
+                       STATIONS[s + 1], left, sold[k][d][s], SEATS);
+                failures++;
+            }
+        }
+    }
+    return failures;
+}
+
+// Phase 1: bookings fed through ShardExecutor like stdin
+static void runSharded(TicketSystem& system, int shards, int rounds) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        exit(1);
+    }
+    std::thread writer([&] {
+        Lcg lcg(1);
+        char buf[256];
+        for (int i = 0; i < rounds; i++) {
+            if (i % 64 == 63) {
+                snprintf(buf, sizeof(buf), "query_ticket -s A -t D -d 06-0%d\n", 1 + lcg.next(DAYS));
+            } else {
+                bookingCommand(lcg, lcg.next(USERS), buf, sizeof(buf) - 1);
+                strcat(buf, "\n");
+            }
+            if (write(fds[1], buf, strlen(buf)) < 0) break;
+        }
+        close(fds[1]);
+    });
+
+    std::ostringstream replies;
+    std::streambuf* original = std::cout.rdbuf(replies.rdbuf());
+    {
+        CommandReader reader(fds[0]);
+        ShardExecutor executor(system, shards);
+        executor.run(reader);
+    }
+    std::cout.rdbuf(original);
+    writer.join();
+    close(fds[0]);
+}
+
+// Phase 2: threads calling processCommand at once, each with its own users
+static void runThreads(TicketSystem& system, int threads, int rounds) {
+    std::atomic<bool> stop(false);
+    std::thread reader([&] {
+        std::ostringstream sink;
+        TicketSystem::setReplyStream(&sink);
+        for (int n = 0; !stop.load(); n++) {
+            system.processCommand(n % 2 ? "query_ticket -s A -t D -d 06-01" : "query_ticket -s B -t C -d 06-02 -p cost");
+            sink.str("");
+        }
+        TicketSystem::setReplyStream(nullptr);
+    });
+
+    std::thread* bookers = new std::thread[threads];
+    for (int t = 0; t < threads; t++) {
+        bookers[t] = std::thread([&system, t, threads, rounds] {
+            std::ostringstream sink;
+            TicketSystem::setReplyStream(&sink);
+            Lcg lcg(100 + t);
+            char buf[256];
+            for (int i = 0; i < rounds / threads; i++) {
+                int u = t + threads * lcg.next(USERS / threads);
+                bookingCommand(lcg, u, buf, sizeof(buf));
+                system.processCommand(buf);
+                sink.str("");
+            }
+            TicketSystem::setReplyStream(nullptr);
+        });
+    }
+    for (int t = 0; t < threads; t++) bookers[t].join();
+    delete[] bookers;
+    stop.store(true);
+    reader.join();
+}
+
+int main(int argc, char* argv[]) {
+    int shards = 8;
+    int threads = 8;
+    int rounds = 200000;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--shards=", 9) == 0) shards = atoi(argv[i] + 9);
+        if (strncmp(argv[i], "--threads=", 10) == 0) threads = atoi(argv[i] + 10);
+        if (strncmp(argv[i], "--rounds=", 9) == 0) rounds = atoi(argv[i] + 9);
+    }
+    if (threads < 1) threads = 1;
+    if (threads > USERS) threads = USERS;
+
+    unlink(STRESS_DB);
+    TicketSystem system(STRESS_DB);
+    system.setWorkers(4);
+    setup(system);
+
+    runSharded(system, shards, rounds);
+    int failures = check(system, "sharded");
+    runThreads(system, threads, rounds);
+    failures += check(system, "threads");
+
+    unlink(STRESS_DB);
+    printf(failures == 0 ? "OK\n" : "FAILED\n");
+    return failures == 0 ? 0 : 1;
+}